@@ -0,0 +1,278 @@
+/**
+ * Solution cache shared by the server's workers.
+ *
+ * Cubes which are conjugate under one of the 48 FullSymmetry (rotations and
+ * reflections of the whole cube) have solutions of the same length, made of
+ * conjugate moves. The cache is therefore keyed by a canonical
+ * representative: the smallest of the 48 conjugates of the cube (and, if
+ * `use_inverse`, of its inverse too, whose solution is the reversed inverse
+ * one). A hit is conjugated back with FullCanonicalPermutationConjugate.
+ *
+ * Memory is fixed at cache_init. The cache is split into CACHE_SHARDS shards,
+ * each one behind its own lock, and each shard into sets of CACHE_WAYS
+ * entries: a new solution replaces the least recently used entry of its set.
+ */
+
+#ifndef __CACHE__
+#define __CACHE__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "queue.h"
+#include "rubik-optimal/src/permutation.cpp"
+#include "rubik-optimal/src/symmetry.cpp"
+
+const int CACHE_SHARDS = 64;
+const int CACHE_WAYS = 8;
+// optimal solutions never take more than 20 moves. Longer ones are not cached
+const int CACHE_MAX_MOVES = 20;
+
+/**
+ * A canonical representative, and how the cube it was computed from maps to
+ * it
+ */
+struct cache_key_t {
+  uint64_t corners;
+  uint64_t edges;
+  /**
+   * The representative is FullSymmetryConjugate(cube, symmetry), or that of
+   * the inverse of the cube if `inverted`
+   */
+  int symmetry;
+  bool inverted;
+};
+
+struct cache_entry_t {
+  uint64_t corners;
+  uint64_t edges;
+  /**
+   * When the entry was last used, from the shard's clock. 0 if empty
+   */
+  uint64_t used_at;
+  unsigned char length;
+  /**
+   * Solution of the representative, as CanonicalPermutationIndex values
+   */
+  unsigned char moves[CACHE_MAX_MOVES];
+};
+
+struct cache_stats_t {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t insertions;
+  uint64_t evictions;
+};
+
+struct cache_shard_t {
+  alignas(CACHE_LINE_SIZE) pthread_mutex_t lock;
+  uint64_t clock;
+  struct cache_stats_t stats;
+  struct cache_entry_t* entries;
+};
+
+struct cache_t {
+  struct cache_shard_t shards[CACHE_SHARDS];
+  size_t sets_per_shard;
+  bool use_inverse;
+};
+
+/**
+ * Splits `memory_budget` bytes among the shards. Returns false if the budget
+ * does not fit one set per shard
+ */
+bool cache_init(struct cache_t* cache, size_t memory_budget, bool use_inverse) {
+  cache->sets_per_shard = memory_budget / (CACHE_SHARDS * CACHE_WAYS *
+                                           sizeof(struct cache_entry_t));
+  cache->use_inverse = use_inverse;
+  if (cache->sets_per_shard == 0) {
+    return false;
+  }
+  for (int s = 0; s < CACHE_SHARDS; s++) {
+    struct cache_shard_t* shard = &cache->shards[s];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->clock = 0;
+    memset(&shard->stats, 0, sizeof(shard->stats));
+    shard->entries = (struct cache_entry_t*)calloc(
+        cache->sets_per_shard * CACHE_WAYS, sizeof(struct cache_entry_t));
+    if (shard->entries == NULL) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * The smaller of `key` and the packed `p`
+ */
+inline void cache_keep_smaller(struct cache_key_t* key,
+                               const Permutation& p,
+                               int symmetry,
+                               bool inverted) {
+  uint64_t corners = 0;
+  uint64_t edges = 0;
+  for (int i = 0; i < CornerCubieLength; i++) {
+    corners = (corners << 5) | (p.corners[i].replaced_by << 2) |
+              p.corners[i].orientation;
+  }
+  for (int i = 0; i < EdgeCubieLength; i++) {
+    edges =
+        (edges << 5) | (p.edges[i].replaced_by << 1) | p.edges[i].orientation;
+  }
+  if (corners < key->corners ||
+      (corners == key->corners && edges < key->edges)) {
+    key->corners = corners;
+    key->edges = edges;
+    key->symmetry = symmetry;
+    key->inverted = inverted;
+  }
+}
+
+struct cache_key_t cache_canonical_key(struct cache_t* cache,
+                                       const Permutation& cube) {
+  struct cache_key_t key;
+  key.corners = UINT64_MAX;
+  key.edges = UINT64_MAX;
+  Permutation inverse = cache->use_inverse ? Permutation::inverse(cube) : cube;
+  for (int s = 0; s < FullSymmetryLength; s++) {
+    cache_keep_smaller(
+        &key,
+        Permutation::mult(Permutation::mult(FullSymmetry[s], cube),
+                          FullInverseSymmetry[s]),
+        s, false);
+    if (cache->use_inverse) {
+      cache_keep_smaller(
+          &key,
+          Permutation::mult(Permutation::mult(FullSymmetry[s], inverse),
+                            FullInverseSymmetry[s]),
+          s, true);
+    }
+  }
+  return key;
+}
+
+inline int cache_inverse_move(int move) {
+  // CanonicalPermutation holds the 6 quarter turns, then the 6 half turns,
+  // then the 6 inverse quarter turns
+  return move < 6 ? move + 12 : move < 12 ? move : move - 12;
+}
+
+/**
+ * Maps a solution of the cube `key` was computed from to a solution of the
+ * representative (`to_representative`) or the other way around
+ */
+void cache_map_solution(const struct cache_key_t& key,
+                        bool to_representative,
+                        const unsigned char* moves,
+                        unsigned char* mapped,
+                        int length) {
+  int symmetry = to_representative ? key.symmetry
+                                   : FullInverseSymmetryIndex[key.symmetry];
+  for (int i = 0; i < length; i++) {
+    int move = key.inverted ? cache_inverse_move(moves[length - 1 - i])
+                            : moves[i];
+    mapped[i] = FullCanonicalPermutationConjugate[move][symmetry];
+  }
+}
+
+inline struct cache_entry_t* cache_find_set(struct cache_t* cache,
+                                            const struct cache_key_t& key,
+                                            struct cache_shard_t** shard) {
+  uint64_t hash = (key.corners ^ (key.edges * 0x9E3779B97F4A7C15ULL)) *
+                  0xBF58476D1CE4E5B9ULL;
+  *shard = &cache->shards[hash >> 58];
+  return &(*shard)->entries[(hash % cache->sets_per_shard) * CACHE_WAYS];
+}
+
+/**
+ * Returns false on a miss. On a hit, the solution of the cube `key` was
+ * computed from is written to `moves`
+ */
+bool cache_lookup(struct cache_t* cache,
+                  const struct cache_key_t& key,
+                  unsigned char* moves,
+                  int* length) {
+  struct cache_shard_t* shard;
+  struct cache_entry_t* set = cache_find_set(cache, key, &shard);
+  unsigned char found[CACHE_MAX_MOVES];
+
+  pthread_mutex_lock(&shard->lock);
+  for (int way = 0; way < CACHE_WAYS; way++) {
+    struct cache_entry_t* entry = &set[way];
+    if (entry->used_at != 0 && entry->corners == key.corners &&
+        entry->edges == key.edges) {
+      entry->used_at = ++shard->clock;
+      *length = entry->length;
+      memcpy(found, entry->moves, entry->length);
+      shard->stats.hits++;
+      pthread_mutex_unlock(&shard->lock);
+
+      cache_map_solution(key, false, found, moves, *length);
+      return true;
+    }
+  }
+  shard->stats.misses++;
+  pthread_mutex_unlock(&shard->lock);
+  return false;
+}
+
+/**
+ * Stores the solution of the cube `key` was computed from
+ */
+void cache_insert(struct cache_t* cache,
+                  const struct cache_key_t& key,
+                  const unsigned char* moves,
+                  int length) {
+  if (length > CACHE_MAX_MOVES) {
+    return;
+  }
+  unsigned char mapped[CACHE_MAX_MOVES];
+  cache_map_solution(key, true, moves, mapped, length);
+
+  struct cache_shard_t* shard;
+  struct cache_entry_t* set = cache_find_set(cache, key, &shard);
+
+  pthread_mutex_lock(&shard->lock);
+  struct cache_entry_t* victim = &set[0];
+  for (int way = 0; way < CACHE_WAYS; way++) {
+    struct cache_entry_t* entry = &set[way];
+    if (entry->used_at != 0 && entry->corners == key.corners &&
+        entry->edges == key.edges) {
+      // another worker solved the same cube meanwhile
+      pthread_mutex_unlock(&shard->lock);
+      return;
+    }
+    if (entry->used_at < victim->used_at) {
+      victim = entry;
+    }
+  }
+  if (victim->used_at != 0) {
+    shard->stats.evictions++;
+  }
+  shard->stats.insertions++;
+  victim->corners = key.corners;
+  victim->edges = key.edges;
+  victim->used_at = ++shard->clock;
+  victim->length = length;
+  memcpy(victim->moves, mapped, length);
+  pthread_mutex_unlock(&shard->lock);
+}
+
+struct cache_stats_t cache_get_stats(struct cache_t* cache) {
+  struct cache_stats_t total;
+  memset(&total, 0, sizeof(total));
+  for (int s = 0; s < CACHE_SHARDS; s++) {
+    struct cache_shard_t* shard = &cache->shards[s];
+    pthread_mutex_lock(&shard->lock);
+    total.hits += shard->stats.hits;
+    total.misses += shard->stats.misses;
+    total.insertions += shard->stats.insertions;
+    total.evictions += shard->stats.evictions;
+    pthread_mutex_unlock(&shard->lock);
+  }
+  return total;
+}
+
+#endif
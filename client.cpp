@@ -1,13 +1,19 @@
 /**
  * Usage: ./client server_hostname server_port client_count seconds_duration
+ *                 [pipeline_depth] [text|binary] [fast|anytime=MS]
  *
  * Creates a client that connects to `server_hostname`:`server_port`, sends a
  * scrambled rubik cube (a hash of it) and waits for the server to return the
  * moves which should be applied to the cube to solve it.
  *
  * 'client_count' threads are created to establish connections, and each one
- * connects indefinitely many times to the server, sending the cube and
- * verifying the response.
+ * keeps a single connection to the server, sending the cube indefinitely many
+ * times over it and verifying the responses. Up to 'pipeline_depth' (default
+ * 1) cubes are sent without waiting for their replies. Cubes go as text
+ * payloads unless 'binary' is given, in which case the compact protocol of
+ * protocol.h is used. With 'fast', the server is asked for short solutions
+ * (two-phase solver) rather than optimal ones. With 'anytime=MS', for the
+ * shortest solutions found within MS milliseconds (anytime solver).
  *
  * When the main thread wants the others to stop, it signals so by the
  * arguments passed to them. This shutdown procedure is done
@@ -30,6 +36,7 @@
 #include <unistd.h>
 #include <iomanip>
 
+#include "protocol.h"
 #include "rubik-optimal/src/hash.cpp"
 
 #include "setdebug.h"
@@ -102,20 +109,175 @@ vector<Permutation> parse_moves(char* moves) {
 }
 
 /**
- * Each client thread will connect to the server and establish
- * (one at a time) connections to it.
+ * How the server should solve the cubes
+ */
+struct solve_mode_t {
+  bool fast;
+  /**
+   * When not fast, a negative budget asks for optimal solutions
+   */
+  long budget_ms;
+};
+
+void send_text_request(int sockfd, char* buffer, unsigned int id,
+                       string& hash, struct solve_mode_t mode) {
+  bzero(buffer, MAX_PAYLOAD_SIZE);
+  if (mode.fast) {
+    snprintf(buffer, MAX_PAYLOAD_SIZE, "%u;fast;%s", id, hash.c_str());
+  } else if (mode.budget_ms >= 0) {
+    snprintf(buffer, MAX_PAYLOAD_SIZE, "%u;anytime=%ld;%s", id,
+             mode.budget_ms, hash.c_str());
+  } else {
+    snprintf(buffer, MAX_PAYLOAD_SIZE, "%u;%s", id, hash.c_str());
+  }
+  if (write(sockfd, buffer, MAX_PAYLOAD_SIZE) < 0) {
+    error("ERROR writing to socket");
+  }
+}
+
+/**
+ * What the server replied, but for the id
+ */
+struct reply_t {
+  /**
+   * A ReplyStatus
+   */
+  unsigned char status;
+  /**
+   * With STATUS_SOLVED
+   */
+  vector<Permutation> moves;
+  /**
+   * With STATUS_SOLVED, whether the server proved no solution is shorter.
+   * Text replies do not tell
+   */
+  bool optimal;
+  /**
+   * With STATUS_BUSY, milliseconds to wait before sending again
+   */
+  long retry_after;
+  /**
+   * With STATUS_TIMEOUT, the depth the search reached
+   */
+  int searched_depth;
+};
+
+// returns the id the reply was tagged with
+unsigned int receive_text_reply(int sockfd,
+                                char* buffer,
+                                struct reply_t* reply) {
+  if (recv(sockfd, buffer, MAX_PAYLOAD_SIZE, MSG_WAITALL) < MAX_PAYLOAD_SIZE) {
+    error("ERROR on receive from socket");
+  }
+
+  printf("Client received %s\n", buffer);
+
+  char* moves_start;
+  unsigned int id = strtoul(buffer, &moves_start, 10);
+  if (*moves_start != ';') {
+    error("ERROR reply has no valid id");
+  }
+  reply->moves.clear();
+  reply->optimal = true;
+  if (strncmp(moves_start + 1, "BUSY ", 5) == 0) {
+    reply->status = STATUS_BUSY;
+    reply->retry_after = strtoul(moves_start + 6, NULL, 10);
+  } else if (strncmp(moves_start + 1, "TIMEOUT ", 8) == 0) {
+    reply->status = STATUS_TIMEOUT;
+    reply->searched_depth = atoi(moves_start + 9);
+  } else {
+    reply->status = STATUS_SOLVED;
+    reply->moves = parse_moves(moves_start + 1);
+  }
+  return id;
+}
+
+void send_binary_request(int sockfd, unsigned char* buffer, unsigned int id,
+                         Permutation& cube, struct solve_mode_t mode) {
+  struct v2_header_t header;
+  header.kind_or_status = CUBE_KIND_CUBIES;
+  header.flags = mode.fast ? PROTOCOL_FLAG_FAST : 0;
+  header.body_length = PROTOCOL_V2_CUBIES_SIZE;
+  header.request_id = id;
+  if (!mode.fast && mode.budget_ms >= 0) {
+    header.flags = PROTOCOL_FLAG_ANYTIME;
+    header.body_length += PROTOCOL_V2_BUDGET_SIZE;
+    v2_write_uint32(buffer + PROTOCOL_V2_HEADER_SIZE + PROTOCOL_V2_CUBIES_SIZE,
+                    mode.budget_ms);
+  }
+  v2_write_header(buffer, header);
+  v2_write_cubies(buffer + PROTOCOL_V2_HEADER_SIZE, cube);
+  if (write(sockfd, buffer, PROTOCOL_V2_HEADER_SIZE + header.body_length) <
+      0) {
+    error("ERROR writing to socket");
+  }
+}
+
+// returns the id the reply was tagged with
+unsigned int receive_binary_reply(int sockfd,
+                                  unsigned char* buffer,
+                                  struct reply_t* reply) {
+  if (recv(sockfd, buffer, PROTOCOL_V2_HEADER_SIZE, MSG_WAITALL) <
+          PROTOCOL_V2_HEADER_SIZE ||
+      buffer[0] != PROTOCOL_V2_MAGIC) {
+    error("ERROR on receive from socket");
+  }
+  struct v2_header_t header = v2_read_header(buffer);
+  if (header.body_length > 0 &&
+      recv(sockfd, buffer, header.body_length, MSG_WAITALL) <
+          header.body_length) {
+    error("ERROR on receive from socket");
+  }
+  reply->status = header.kind_or_status;
+  reply->moves.clear();
+  reply->optimal = (header.flags & REPLY_FLAG_UNPROVEN) == 0;
+  if (header.kind_or_status == STATUS_BUSY &&
+      header.body_length == PROTOCOL_V2_BUSY_SIZE) {
+    reply->retry_after = v2_read_uint32(buffer);
+    return header.request_id;
+  }
+  if (header.kind_or_status == STATUS_TIMEOUT &&
+      header.body_length == PROTOCOL_V2_TIMEOUT_SIZE) {
+    reply->searched_depth = buffer[0];
+    return header.request_id;
+  }
+  if (header.kind_or_status != STATUS_SOLVED) {
+    error("ERROR server did not solve the cube");
+  }
+  for (int i = 0; i < header.body_length; i++) {
+    if (buffer[i] >= CanonicalPermutationLength) {
+      error("ERROR reply has an invalid move");
+    }
+    reply->moves.push_back(CanonicalPermutation[buffer[i]]);
+  }
+  return header.request_id;
+}
+
+/**
+ * Each client thread will connect to the server once and send
+ * cubes over that connection, keeping up to 'pipeline_depth' of them
+ * in the server at any time.
  *
- * On every successfully closed connection, 'request_count'
- * is incremented by the thread, using 'request_count_lock' to avoid
- * sync problems.
+ * On every received reply, 'request_count' (or 'busy_count' if the
+ * server was too busy to solve the cube, 'timeout_count' if it gave up on
+ * it) is incremented by the thread, using 'request_count_lock' to avoid sync
+ * problems. After a busy reply the thread waits for as long as the server
+ * asked before sending again.
  *
  * 'should_stop' is set by the main thread when it wants
- * the works to return.
+ * the works to return. They stop sending cubes, wait for the replies
+ * still on the way and close the connection.
  *
  */
 struct connection_loop_arg_t {
   struct sockaddr_in server_address;
+  int pipeline_depth;
+  bool binary;
+  struct solve_mode_t mode;
   int request_count;
+  int unproven_count;
+  int busy_count;
+  int timeout_count;
   sem_t request_count_lock;
   bool should_stop;
 };
@@ -123,15 +285,21 @@ struct connection_loop_arg_t {
 void* connection_loop(void* args) {
   struct sockaddr_in server_address =
       ((connection_loop_arg_t*)args)->server_address;
+  int pipeline_depth = ((connection_loop_arg_t*)args)->pipeline_depth;
+  bool binary = ((connection_loop_arg_t*)args)->binary;
+  struct solve_mode_t mode = ((connection_loop_arg_t*)args)->mode;
   sem_t* request_count_lock =
       &((connection_loop_arg_t*)args)->request_count_lock;
   int* request_count = &((connection_loop_arg_t*)args)->request_count;
+  int* unproven_count = &((connection_loop_arg_t*)args)->unproven_count;
+  int* busy_count = &((connection_loop_arg_t*)args)->busy_count;
+  int* timeout_count = &((connection_loop_arg_t*)args)->timeout_count;
   bool* should_stop = &((connection_loop_arg_t*)args)->should_stop;
-  struct sockaddr_in serv_addr;
   int sockfd;
   char* buffer;
 
-  buffer = (char*)malloc(MAX_PAYLOAD_SIZE * sizeof(char));
+  // big enough for both protocols
+  buffer = (char*)malloc(PROTOCOL_V2_MAX_FRAME_SIZE * sizeof(char));
 
   // build a cube to ask the server to solve.
   // this configuration takes 11 moves to solve.
@@ -142,59 +310,85 @@ void* connection_loop(void* args) {
        CanonicalPermutation[U], CanonicalPermutation[D2],
        CanonicalPermutation[Ri], CanonicalPermutation[F2],
        CanonicalPermutation[B]});
+  string hash = Hash(reference);
 
-  while (true) {
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
-      error("ERROR opening socket");
-    }
+  sockfd = socket(AF_INET, SOCK_STREAM, 0);
+  if (sockfd < 0) {
+    error("ERROR opening socket");
+  }
 
-    // copy-constructor (means 'test' is a copy of 'reference')
-    Permutation test = reference;
+  if (connect(sockfd, (struct sockaddr*)&server_address,
+              sizeof(server_address)) < 0) {
+    error("ERROR connecting");
+  }
 
-    string hash = Hash(test);
-    for (int i = 0; i < hash.length(); i++) {
-      buffer[i] = hash[i];
-    }
-    buffer[hash.length()] = '\0';
+  // every payload is tagged with an id, echoed back in its reply
+  unsigned int next_id = 0;
+  int outstanding = 0;
+  bool stopping = false;
 
-    if (connect(sockfd, (struct sockaddr*)&server_address,
-                sizeof(server_address)) < 0) {
-      error("ERROR connecting");
+  while (true) {
+    while (!stopping && outstanding < pipeline_depth) {
+      if (binary) {
+        send_binary_request(sockfd, (unsigned char*)buffer, next_id++,
+                            reference, mode);
+      } else {
+        send_text_request(sockfd, buffer, next_id++, hash, mode);
+      }
+      outstanding++;
     }
 
-    if (write(sockfd, buffer, MAX_PAYLOAD_SIZE) < 0) {
-      error("ERROR writing to socket");
+    if (outstanding == 0) {
+      break;
     }
 
-    if (recv(sockfd, buffer, MAX_PAYLOAD_SIZE, MSG_WAITALL) < 0) {
-      error("ERROR on receive from socket");
+    struct reply_t reply;
+    unsigned int id =
+        binary ? receive_binary_reply(sockfd, (unsigned char*)buffer, &reply)
+               : receive_text_reply(sockfd, buffer, &reply);
+    if (id >= next_id) {
+      error("ERROR reply has no valid id");
     }
+    outstanding--;
 
-    printf("Client received %s\n", buffer);
-
-    // check if the cube was correctly solved
-    auto moves = parse_moves(buffer);
-    for (int i = 0; i < moves.size(); i++) {
-      test = Permutation::mult(test, moves[i]);
-    }
+    if (reply.status == STATUS_SOLVED) {
+      // check if the cube was correctly solved
+      Permutation test = reference;
+      for (int i = 0; i < reply.moves.size(); i++) {
+        test = Permutation::mult(test, reply.moves[i]);
+      }
 
-    if (!Permutation::equals(test, Permutation::identity())) {
-      error("ERROR cube was not solved correctly");
+      if (!Permutation::equals(test, Permutation::identity())) {
+        error("ERROR cube was not solved correctly");
+      }
     }
 
-    close(sockfd);
-
     sem_wait(request_count_lock);
-    *request_count += 1;
+    if (reply.status == STATUS_BUSY) {
+      *busy_count += 1;
+    } else if (reply.status == STATUS_TIMEOUT) {
+      *timeout_count += 1;
+    } else {
+      *request_count += 1;
+      if (!reply.optimal) {
+        *unproven_count += 1;
+      }
+    }
     sem_post(request_count_lock);
 
-    // stop if the main thread signaled so
+    if (reply.status == STATUS_BUSY && !*should_stop) {
+      usleep(reply.retry_after * 1000);
+    }
+
+    // stop sending if the main thread signaled so
     if (*should_stop) {
-      free(buffer);
-      return (void*)NULL;
+      stopping = true;
     }
   }
+
+  close(sockfd);
+  free(buffer);
+  return (void*)NULL;
 }
 
 int main(int argc, char* argv[]) {
@@ -203,25 +397,41 @@ int main(int argc, char* argv[]) {
   int client_count;
   int requests_per_client;
   int duration_seconds;
+  int pipeline_depth;
+  bool binary;
+  struct solve_mode_t mode;
 
   if (argc < 5) {
-    fprintf(
-        stderr,
-        "usage %s server_hostname server_port client_count duration_seconds\n",
-        argv[0]);
+    fprintf(stderr,
+            "usage %s server_hostname server_port client_count "
+            "duration_seconds [pipeline_depth] [text|binary] "
+            "[fast|anytime=MS]\n",
+            argv[0]);
     exit(0);
   }
   server_hostname = argv[1];
   server_port = atoi(argv[2]);
   client_count = atoi(argv[3]);
   duration_seconds = atoi(argv[4]);
+  pipeline_depth = argc > 5 ? atoi(argv[5]) : 1;
+  binary = argc > 6 && strcmp(argv[6], "binary") == 0;
+  mode.fast = argc > 7 && strcmp(argv[7], "fast") == 0;
+  mode.budget_ms = argc > 7 && strncmp(argv[7], "anytime=", 8) == 0
+                       ? atol(argv[7] + 8)
+                       : -1;
 
   pthread_t* threads = (pthread_t*)malloc(client_count * sizeof(pthread_t*));
 
   // setup args for worker threads
   connection_loop_arg_t args;
   args.server_address = preconnection_setup(server_port, server_hostname);
+  args.pipeline_depth = pipeline_depth;
+  args.binary = binary;
+  args.mode = mode;
   args.request_count = 0;
+  args.unproven_count = 0;
+  args.busy_count = 0;
+  args.timeout_count = 0;
   args.should_stop = false;
   sem_init(&args.request_count_lock, 1, 1);
 
@@ -254,6 +464,17 @@ int main(int argc, char* argv[]) {
 
   cout << "Ran for " << elapsed << " milliseconds;" << endl;
   cout << "Processed " << args.request_count << " requests;" << endl;
+  if (args.unproven_count > 0) {
+    cout << "Solved without proving optimality: " << args.unproven_count
+         << " requests;" << endl;
+  }
+  if (args.busy_count > 0) {
+    cout << "Refused by a busy server: " << args.busy_count << " requests;"
+         << endl;
+  }
+  if (args.timeout_count > 0) {
+    cout << "Timed out: " << args.timeout_count << " requests;" << endl;
+  }
   cout << "Average of ";
   cout << fixed;
   cout << setprecision(3);
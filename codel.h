@@ -0,0 +1,106 @@
+/**
+ * CoDel ("controlled delay", RFC 8289) decision of whether to shed a request
+ * taken out of a queue, based on how long it waited in it (its sojourn time).
+ *
+ * Short bursts are absorbed: nothing is shed until the sojourn time stayed
+ * above `target` for a whole `interval`. From then on requests are shed at a
+ * rate that grows with the square root of the number of drops, until the
+ * sojourn time falls below `target` again. Standing queues are drained while
+ * the requests which get through keep a bounded latency.
+ *
+ * All times are in nanoseconds.
+ */
+
+#ifndef __CODEL__
+#define __CODEL__
+
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+struct codel_t {
+  pthread_mutex_t lock;
+  uint64_t target;
+  uint64_t interval;
+  /**
+   * When the sojourn time will have been above target for a whole interval.
+   * 0 while it is below
+   */
+  uint64_t first_above_time;
+  /**
+   * While dropping, when the next request is shed
+   */
+  uint64_t drop_next;
+  uint32_t count;
+  uint32_t last_count;
+  bool dropping;
+};
+
+void codel_init(struct codel_t* codel, uint64_t target, uint64_t interval) {
+  pthread_mutex_init(&codel->lock, NULL);
+  codel->target = target;
+  codel->interval = interval;
+  codel->first_above_time = 0;
+  codel->drop_next = 0;
+  codel->count = 0;
+  codel->last_count = 0;
+  codel->dropping = false;
+}
+
+inline uint64_t codel_control_law(struct codel_t* codel, uint64_t t) {
+  return t + (uint64_t)(codel->interval / sqrt((double)codel->count));
+}
+
+// must hold codel->lock
+bool codel_ok_to_drop(struct codel_t* codel,
+                      uint64_t sojourn,
+                      uint64_t now,
+                      size_t backlog) {
+  // an empty queue is no standing queue, however long this request waited
+  if (sojourn < codel->target || backlog == 0) {
+    codel->first_above_time = 0;
+    return false;
+  }
+  if (codel->first_above_time == 0) {
+    codel->first_above_time = now + codel->interval;
+    return false;
+  }
+  return now >= codel->first_above_time;
+}
+
+/**
+ * Called for every request taken out of the queue, with the number of
+ * requests still in it (`backlog`). Returns true if it should be shed
+ */
+bool codel_should_drop(struct codel_t* codel,
+                       uint64_t sojourn,
+                       uint64_t now,
+                       size_t backlog) {
+  bool drop = false;
+  pthread_mutex_lock(&codel->lock);
+  bool ok_to_drop = codel_ok_to_drop(codel, sojourn, now, backlog);
+  if (codel->dropping) {
+    if (!ok_to_drop) {
+      codel->dropping = false;
+    } else if (now >= codel->drop_next) {
+      drop = true;
+      codel->count++;
+      codel->drop_next = codel_control_law(codel, codel->drop_next);
+    }
+  } else if (ok_to_drop) {
+    drop = true;
+    codel->dropping = true;
+    // resume close to the previous drop rate if dropping stopped recently
+    uint32_t delta = codel->count - codel->last_count;
+    codel->count = delta > 1 && now - codel->drop_next < 16 * codel->interval
+                       ? delta
+                       : 1;
+    codel->drop_next = codel_control_law(codel, now);
+    codel->last_count = codel->count;
+  }
+  pthread_mutex_unlock(&codel->lock);
+  return drop;
+}
+
+#endif
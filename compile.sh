@@ -1,3 +1,13 @@
-g++ -O3 client.cpp -o client -lpthread -lrt # -lpthread must be at the END !
-g++ -O3 server.cpp -o server -lpthread -lrt
+# -mssse3 lets Permutation::mult and equals use pshufb (permutation.cpp)
+g++ -O3 -mssse3 client.cpp -o client -lpthread -lrt # -lpthread must be at the END !
+# table_bundle.bin is only mapped by binaries built from the table sources it
+# was saved from (see TableSourceHash in tablebundle.cpp)
+TABLE_SOURCE_HASH=$(cd rubik-optimal/src && cat permutation.cpp symmetry.cpp \
+  coordinate.cpp movetable.cpp twophase.cpp tablebundle.cpp | cksum | cut -d ' ' -f 1)
+# add -DSOLVE_STATS to export search statistics (see SolveStats in solve.cpp)
+g++ -O3 -mssse3 -DTABLE_SOURCE_HASH=$TABLE_SOURCE_HASH server.cpp -o server -lpthread -lrt
+g++ -O3 queue_benchmark.cpp -o queue_benchmark -lpthread
+# ./buildtable --tables-only writes table_bundle.bin, which spares every
+# later process seconds of table building at startup (tablebundle.cpp)
+g++ -O3 -mssse3 -DTABLE_SOURCE_HASH=$TABLE_SOURCE_HASH rubik-optimal/src/buildtable.cpp -o buildtable -lpthread
 echo "Done !"
@@ -0,0 +1,335 @@
+/**
+ * Server telemetry: latency histograms and counters.
+ *
+ * Every thread records into its own metrics_t, registered once in a
+ * metrics_registry_t, so recording is a few plain loads and stores on memory
+ * no other thread writes: no lock, no atomic read-modify-write. A scrape
+ * merges all of them (metrics_merge) and prints the result in the Prometheus
+ * text format (metrics_print).
+ *
+ * Histograms are HDR-style: values below 2^HISTOGRAM_PRECISION_BITS get a
+ * bucket each, then every power of two is split into 2^HISTOGRAM_PRECISION_BITS
+ * buckets, so a quantile is off by at most 1/16th of its value. They are
+ * exported as Prometheus summaries (p50, p90, p99 and p999, sum and count).
+ *
+ * Servers built with SOLVE_STATS also count what the searches did (see
+ * SolveStats): prunes by rule, table lookups, and per IDA* depth the nodes
+ * generated and expanded and the time spent, as counters labeled by depth.
+ */
+
+#ifndef __METRICS__
+#define __METRICS__
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "queue.h"
+
+const int HISTOGRAM_PRECISION_BITS = 4;
+// values are nanoseconds: the last bucket holds everything past 18 minutes
+const int HISTOGRAM_MAGNITUDE_BITS = 40;
+const int HISTOGRAM_BUCKETS =
+    (HISTOGRAM_MAGNITUDE_BITS - HISTOGRAM_PRECISION_BITS + 1)
+    << HISTOGRAM_PRECISION_BITS;
+
+enum Timer {
+  /**
+   * From the request first trying to enter the request ring, which may be
+   * full, until a worker takes it
+   */
+  TIMER_QUEUE_WAIT,
+  /**
+   * From the frame being complete in the input buffer until it is a cube
+   */
+  TIMER_PARSE,
+  TIMER_SOLVE,
+  /**
+   * From the worker giving the reply back until it is handed to the socket
+   * (or, with io_uring, queued for sending)
+   */
+  TIMER_WRITE,
+  TIMER_COUNT
+};
+
+const char* const TIMER_NAMES[TIMER_COUNT] = {"queue_wait", "parse", "solve",
+                                              "write"};
+
+enum Counter {
+  COUNTER_REQUESTS,
+  COUNTER_MALFORMED,
+  COUNTER_BUSY,
+  COUNTER_TIMEOUTS,
+  COUNTER_CANCELLED,
+  COUNTER_SOLVED,
+  COUNTER_NODES,
+  COUNTER_PRUNED_AXIS,
+  COUNTER_PRUNED_EXPONENT,
+  COUNTER_PRUNED_SYMMETRY,
+  COUNTER_PRUNED_NEIGHBOUR_AXIS,
+  COUNTER_PRUNED_INVERSE,
+  COUNTER_TABLE_LOOKUPS,
+  COUNTER_COUNT
+};
+
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {
+    "requests", "malformed", "busy", "timeouts", "cancelled", "solved",
+    "nodes_expanded", "pruned_axis", "pruned_exponent", "pruned_symmetry",
+    "pruned_neighbour_axis", "pruned_inverse", "table_lookups"};
+
+const char* const COUNTER_HELP[COUNTER_COUNT] = {
+    "Requests parsed, refused or not",
+    "Frames answered with STATUS_MALFORMED or dropping their connection",
+    "Requests refused with STATUS_BUSY",
+    "Searches stopped by their deadline",
+    "Searches stopped because their client left",
+    "Cubes solved by the solver, cache hits excluded",
+    "Nodes expanded by the solver",
+    "Nodes cut by their pruning values with the rest of their axis",
+    "Nodes cut by their pruning values",
+    "Moves not tried because a symmetric one is",
+    "Axes not tried after a move of the same or the opposite one",
+    "Nodes cut by the pruning values of their inverse",
+    "Pruning table entries looked up for generated nodes"};
+
+// IDA* depths told apart by the depth counters. The last one also counts the
+// deeper ones
+const int METRICS_DEPTHS = 21;
+
+enum DepthCounter {
+  DEPTH_GENERATED,
+  DEPTH_EXPANDED,
+  /**
+   * Nanoseconds, exported as seconds
+   */
+  DEPTH_TIME,
+  DEPTH_COUNTER_COUNT
+};
+
+const char* const DEPTH_COUNTER_NAMES[DEPTH_COUNTER_COUNT] = {
+    "depth_nodes_generated_total", "depth_nodes_expanded_total",
+    "depth_seconds_total"};
+
+const char* const DEPTH_COUNTER_HELP[DEPTH_COUNTER_COUNT] = {
+    "Nodes generated by IDA* iterations of that boundary depth",
+    "Nodes expanded by IDA* iterations of that boundary depth",
+    "Time spent in IDA* iterations of that boundary depth"};
+
+struct histogram_t {
+  std::atomic<uint64_t> buckets[HISTOGRAM_BUCKETS];
+  std::atomic<uint64_t> sum;
+};
+
+/**
+ * One thread's metrics. Only that thread writes to them
+ */
+struct metrics_t {
+  struct histogram_t timers[TIMER_COUNT];
+  std::atomic<uint64_t> counters[COUNTER_COUNT];
+  std::atomic<uint64_t> depth_counters[DEPTH_COUNTER_COUNT][METRICS_DEPTHS];
+  struct metrics_t* next;
+};
+
+/**
+ * A snapshot of every thread's metrics, added up
+ */
+struct metrics_snapshot_t {
+  uint64_t buckets[TIMER_COUNT][HISTOGRAM_BUCKETS];
+  uint64_t sums[TIMER_COUNT];
+  uint64_t counters[COUNTER_COUNT];
+  uint64_t depth_counters[DEPTH_COUNTER_COUNT][METRICS_DEPTHS];
+};
+
+struct metrics_registry_t {
+  pthread_mutex_t lock;
+  struct metrics_t* threads;
+};
+
+void metrics_registry_init(struct metrics_registry_t* registry) {
+  pthread_mutex_init(&registry->lock, NULL);
+  registry->threads = NULL;
+}
+
+/**
+ * The calling thread's metrics, zeroed. They live as long as the registry
+ */
+struct metrics_t* metrics_register(struct metrics_registry_t* registry) {
+  struct metrics_t* metrics = (struct metrics_t*)aligned_alloc(
+      CACHE_LINE_SIZE, (sizeof(struct metrics_t) + CACHE_LINE_SIZE - 1) /
+                           CACHE_LINE_SIZE * CACHE_LINE_SIZE);
+  memset((void*)metrics, 0, sizeof(struct metrics_t));
+  pthread_mutex_lock(&registry->lock);
+  metrics->next = registry->threads;
+  registry->threads = metrics;
+  pthread_mutex_unlock(&registry->lock);
+  return metrics;
+}
+
+inline int histogram_bucket(uint64_t value) {
+  if (value >> HISTOGRAM_MAGNITUDE_BITS) {
+    return HISTOGRAM_BUCKETS - 1;
+  }
+  if (value < (1 << HISTOGRAM_PRECISION_BITS)) {
+    return value;
+  }
+  int shift = 63 - __builtin_clzll(value) - HISTOGRAM_PRECISION_BITS;
+  return ((shift + 1) << HISTOGRAM_PRECISION_BITS) +
+         (value >> shift) - (1 << HISTOGRAM_PRECISION_BITS);
+}
+
+// the smallest value of the next bucket
+inline uint64_t histogram_bucket_end(int bucket) {
+  if (bucket < (2 << HISTOGRAM_PRECISION_BITS)) {
+    return bucket + 1;
+  }
+  int shift = (bucket >> HISTOGRAM_PRECISION_BITS) - 1;
+  uint64_t mantissa = (bucket & ((1 << HISTOGRAM_PRECISION_BITS) - 1)) |
+                      (1 << HISTOGRAM_PRECISION_BITS);
+  return (mantissa + 1) << shift;
+}
+
+// only from the thread which owns `metrics`
+inline void metrics_record(struct metrics_t* metrics,
+                           enum Timer timer,
+                           uint64_t nanoseconds) {
+  struct histogram_t* histogram = &metrics->timers[timer];
+  std::atomic<uint64_t>* bucket =
+      &histogram->buckets[histogram_bucket(nanoseconds)];
+  bucket->store(bucket->load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+  histogram->sum.store(
+      histogram->sum.load(std::memory_order_relaxed) + nanoseconds,
+      std::memory_order_relaxed);
+}
+
+// only from the thread which owns `metrics`
+inline void metrics_count(struct metrics_t* metrics,
+                          enum Counter counter,
+                          uint64_t amount = 1) {
+  std::atomic<uint64_t>* value = &metrics->counters[counter];
+  value->store(value->load(std::memory_order_relaxed) + amount,
+               std::memory_order_relaxed);
+}
+
+// only from the thread which owns `metrics`
+inline void metrics_count_depth(struct metrics_t* metrics,
+                                enum DepthCounter counter,
+                                int depth,
+                                uint64_t amount) {
+  if (depth >= METRICS_DEPTHS) {
+    depth = METRICS_DEPTHS - 1;
+  }
+  std::atomic<uint64_t>* value = &metrics->depth_counters[counter][depth];
+  value->store(value->load(std::memory_order_relaxed) + amount,
+               std::memory_order_relaxed);
+}
+
+void metrics_merge(struct metrics_registry_t* registry,
+                   struct metrics_snapshot_t* snapshot) {
+  memset(snapshot, 0, sizeof(struct metrics_snapshot_t));
+  pthread_mutex_lock(&registry->lock);
+  for (struct metrics_t* metrics = registry->threads; metrics != NULL;
+       metrics = metrics->next) {
+    for (int t = 0; t < TIMER_COUNT; t++) {
+      for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+        snapshot->buckets[t][b] +=
+            metrics->timers[t].buckets[b].load(std::memory_order_relaxed);
+      }
+      snapshot->sums[t] +=
+          metrics->timers[t].sum.load(std::memory_order_relaxed);
+    }
+    for (int c = 0; c < COUNTER_COUNT; c++) {
+      snapshot->counters[c] +=
+          metrics->counters[c].load(std::memory_order_relaxed);
+    }
+    for (int c = 0; c < DEPTH_COUNTER_COUNT; c++) {
+      for (int d = 0; d < METRICS_DEPTHS; d++) {
+        snapshot->depth_counters[c][d] +=
+            metrics->depth_counters[c][d].load(std::memory_order_relaxed);
+      }
+    }
+  }
+  pthread_mutex_unlock(&registry->lock);
+}
+
+/**
+ * The upper end of the bucket holding the `quantile` value, in nanoseconds.
+ * 0 if the histogram is empty
+ */
+uint64_t metrics_quantile(const uint64_t* buckets, double quantile) {
+  uint64_t count = 0;
+  for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+    count += buckets[b];
+  }
+  uint64_t rank = (uint64_t)(quantile * count);
+  uint64_t seen = 0;
+  for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+    seen += buckets[b];
+    if (seen > rank) {
+      return histogram_bucket_end(b) - 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Writes the snapshot in the Prometheus text format, every metric name
+ * starting with `prefix`. Times are in seconds, as Prometheus expects
+ */
+void metrics_print(FILE* out,
+                   const char* prefix,
+                   const struct metrics_snapshot_t* snapshot) {
+  const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+  for (int t = 0; t < TIMER_COUNT; t++) {
+    const char* name = TIMER_NAMES[t];
+    uint64_t count = 0;
+    for (int b = 0; b < HISTOGRAM_BUCKETS; b++) {
+      count += snapshot->buckets[t][b];
+    }
+    fprintf(out, "# TYPE %s_%s_seconds summary\n", prefix, name);
+    for (double quantile : quantiles) {
+      fprintf(out, "%s_%s_seconds{quantile=\"%g\"} %.9f\n", prefix, name,
+              quantile,
+              metrics_quantile(snapshot->buckets[t], quantile) / 1e9);
+    }
+    fprintf(out, "%s_%s_seconds_sum %.9f\n", prefix, name,
+            snapshot->sums[t] / 1e9);
+    fprintf(out, "%s_%s_seconds_count %lu\n", prefix, name, count);
+  }
+  for (int c = 0; c < COUNTER_COUNT; c++) {
+    fprintf(out, "# HELP %s_%s_total %s\n", prefix, COUNTER_NAMES[c],
+            COUNTER_HELP[c]);
+    fprintf(out, "# TYPE %s_%s_total counter\n", prefix, COUNTER_NAMES[c]);
+    fprintf(out, "%s_%s_total %lu\n", prefix, COUNTER_NAMES[c],
+            snapshot->counters[c]);
+  }
+  // only the depths searched, which is none without SOLVE_STATS
+  for (int c = 0; c < DEPTH_COUNTER_COUNT; c++) {
+    bool printed_type = false;
+    for (int d = 0; d < METRICS_DEPTHS; d++) {
+      if (snapshot->depth_counters[c][d] == 0) {
+        continue;
+      }
+      if (!printed_type) {
+        fprintf(out, "# HELP %s_%s %s\n", prefix, DEPTH_COUNTER_NAMES[c],
+                DEPTH_COUNTER_HELP[c]);
+        fprintf(out, "# TYPE %s_%s counter\n", prefix,
+                DEPTH_COUNTER_NAMES[c]);
+        printed_type = true;
+      }
+      if (c == DEPTH_TIME) {
+        fprintf(out, "%s_%s{depth=\"%d\"} %.9f\n", prefix,
+                DEPTH_COUNTER_NAMES[c], d,
+                snapshot->depth_counters[c][d] / 1e9);
+      } else {
+        fprintf(out, "%s_%s{depth=\"%d\"} %lu\n", prefix,
+                DEPTH_COUNTER_NAMES[c], d, snapshot->depth_counters[c][d]);
+      }
+    }
+  }
+}
+
+#endif
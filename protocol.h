@@ -0,0 +1,141 @@
+/**
+ * Binary wire protocol (v2), spoken by both client and server next to the
+ * text protocol of fixed MAX_PAYLOAD_SIZE byte payloads.
+ *
+ * Every v2 frame starts with a PROTOCOL_V2_HEADER_SIZE byte header:
+ *
+ *   byte 0      PROTOCOL_V2_MAGIC. Text payloads never start with it, so the
+ *               server tells the two protocols apart frame by frame
+ *   byte 1      request: a CubeKind. reply: a ReplyStatus
+ *   byte 2      request: flags, see ProtocolFlag. reply: flags, see
+ *               ReplyFlag
+ *   byte 3      length of the body which follows the header
+ *   bytes 4-7   request id, little endian, echoed back in the reply
+ *
+ * Request bodies:
+ *   CUBE_KIND_CUBIES       20 bytes, 8 corners then 12 edges, each one
+ *                          `replaced_by | (orientation << 4)`
+ *   CUBE_KIND_COORDINATES  10 bytes, little endian: corner permutation (2),
+ *                          corner orientation (2), edge permutation (4) and
+ *                          edge orientation (2) coordinates
+ * With PROTOCOL_FLAG_ANYTIME, the cube is followed by a 4 byte time budget,
+ * see below.
+ *
+ * Reply bodies:
+ *   STATUS_SOLVED     one CanonicalPermutationIndex byte per move of the
+ *                     solution
+ *   STATUS_MALFORMED  empty
+ *   STATUS_BUSY       4 bytes, little endian: milliseconds after which the
+ *                     server expects to have room again. The cube was not
+ *                     solved and may be sent again
+ *   STATUS_TIMEOUT    1 byte: the search gave up at the server's deadline,
+ *                     knowing only that no solution has this many moves or
+ *                     fewer
+ */
+
+#ifndef __PROTOCOL__
+#define __PROTOCOL__
+
+#include <stdint.h>
+#include "rubik-optimal/src/permutation.cpp"
+
+const unsigned char PROTOCOL_V2_MAGIC = 0xB2;
+const int PROTOCOL_V2_HEADER_SIZE = 8;
+const int PROTOCOL_V2_CUBIES_SIZE = CornerCubieLength + EdgeCubieLength;
+const int PROTOCOL_V2_COORDINATES_SIZE = 10;
+// bodies are at most 255 bytes long, so no frame is bigger than this
+const int PROTOCOL_V2_MAX_FRAME_SIZE = PROTOCOL_V2_HEADER_SIZE + 255;
+
+enum CubeKind { CUBE_KIND_CUBIES = 1, CUBE_KIND_COORDINATES = 2 };
+
+// PROTOCOL_FLAG_FAST asks for a short solution fast rather than an optimal
+// one (two-phase solver). PROTOCOL_FLAG_ANYTIME asks for the shortest
+// solution found within a budget of milliseconds, given after the cube
+// (anytime solver). Unknown flags are ignored
+enum ProtocolFlag { PROTOCOL_FLAG_FAST = 1, PROTOCOL_FLAG_ANYTIME = 2 };
+
+// REPLY_FLAG_UNPROVEN: the solution may not be optimal (fast and anytime
+// requests)
+enum ReplyFlag { REPLY_FLAG_UNPROVEN = 1 };
+
+enum ReplyStatus {
+  STATUS_SOLVED = 0,
+  STATUS_MALFORMED = 1,
+  STATUS_BUSY = 2,
+  STATUS_TIMEOUT = 3
+};
+
+const int PROTOCOL_V2_BUSY_SIZE = 4;
+const int PROTOCOL_V2_TIMEOUT_SIZE = 1;
+const int PROTOCOL_V2_BUDGET_SIZE = 4;
+
+struct v2_header_t {
+  unsigned char kind_or_status;
+  unsigned char flags;
+  unsigned char body_length;
+  uint32_t request_id;
+};
+
+inline void v2_write_uint32(unsigned char* body, uint32_t value) {
+  body[0] = value & 0xFF;
+  body[1] = (value >> 8) & 0xFF;
+  body[2] = (value >> 16) & 0xFF;
+  body[3] = (value >> 24) & 0xFF;
+}
+
+inline uint32_t v2_read_uint32(const unsigned char* body) {
+  return (uint32_t)body[0] | ((uint32_t)body[1] << 8) |
+         ((uint32_t)body[2] << 16) | ((uint32_t)body[3] << 24);
+}
+
+inline void v2_write_header(unsigned char* frame, struct v2_header_t header) {
+  frame[0] = PROTOCOL_V2_MAGIC;
+  frame[1] = header.kind_or_status;
+  frame[2] = header.flags;
+  frame[3] = header.body_length;
+  v2_write_uint32(frame + 4, header.request_id);
+}
+
+// `frame` must start with PROTOCOL_V2_MAGIC
+inline struct v2_header_t v2_read_header(const unsigned char* frame) {
+  struct v2_header_t header;
+  header.kind_or_status = frame[1];
+  header.flags = frame[2];
+  header.body_length = frame[3];
+  header.request_id = v2_read_uint32(frame + 4);
+  return header;
+}
+
+inline void v2_write_cubies(unsigned char* body, Permutation& cube) {
+  for (int i = 0; i < CornerCubieLength; i++) {
+    body[i] = cube.corners[i].replaced_by | (cube.corners[i].orientation << 4);
+  }
+  for (int i = 0; i < EdgeCubieLength; i++) {
+    body[CornerCubieLength + i] =
+        cube.edges[i].replaced_by | (cube.edges[i].orientation << 4);
+  }
+}
+
+// false if some cubie or orientation is out of range (the cube may still be
+// unsolvable)
+inline bool v2_read_cubies(const unsigned char* body, Permutation* cube) {
+  for (int i = 0; i < CornerCubieLength; i++) {
+    cube->corners[i].replaced_by = body[i] & 15;
+    cube->corners[i].orientation = body[i] >> 4;
+    if (cube->corners[i].replaced_by >= CornerCubieLength ||
+        cube->corners[i].orientation > G2) {
+      return false;
+    }
+  }
+  for (int i = 0; i < EdgeCubieLength; i++) {
+    cube->edges[i].replaced_by = body[CornerCubieLength + i] & 15;
+    cube->edges[i].orientation = body[CornerCubieLength + i] >> 4;
+    if (cube->edges[i].replaced_by >= EdgeCubieLength ||
+        cube->edges[i].orientation > 1) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#endif
@@ -0,0 +1,256 @@
+/**
+ * Queues used to hand items (pointers) between threads.
+ *
+ * queue_t is the original unbounded queue: a doubly linked list guarded by a
+ * semaphore, with one allocation per item. It is kept as the baseline for
+ * queue_benchmark.cpp.
+ *
+ * ring_t is a bounded, lock-free, multi-producer/multi-consumer ring (Dmitry
+ * Vyukov's design): each cell carries a sequence number telling whether it is
+ * ready to be written or read, so producers and consumers only contend on
+ * their own position counter, each one on its own cache line. Consumers that
+ * find the ring empty spin for a while before sleeping on a semaphore, which
+ * producers only touch when somebody is actually asleep.
+ */
+
+#ifndef __QUEUE__
+#define __QUEUE__
+
+#include <sched.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+
+const int CACHE_LINE_SIZE = 64;
+
+/**
+ * Unbounded queue. Producers push to the front, consumers remove from the
+ * back.
+ */
+struct queue_t {
+  /**
+   * A lead node which does not represent an item. Its sucessors do.
+   */
+  struct queue_item_t* lead;
+  /**
+   * Just like a lead node, but for the end of the queue
+   */
+  struct queue_item_t* lead_last;
+  sem_t length;
+  sem_t mutex;
+};
+
+struct queue_item_t {
+  void* item;
+  struct queue_item_t* next;
+  struct queue_item_t* before;
+};
+
+void queue_init(struct queue_t* queue) {
+  queue->lead = (queue_item_t*)malloc(sizeof(queue_item_t));
+  queue->lead_last = (queue_item_t*)malloc(sizeof(queue_item_t));
+  queue->lead->before = NULL;
+  queue->lead->next = queue->lead_last;
+  queue->lead_last->before = queue->lead;
+  queue->lead_last->next = NULL;
+  sem_init(&queue->length, 1, 0);
+  sem_init(&queue->mutex, 1, 1);
+}
+
+void queue_push(struct queue_t* queue, void* item) {
+  sem_wait(&queue->mutex);
+  struct queue_item_t* newitem =
+      (struct queue_item_t*)malloc(sizeof(struct queue_item_t));
+  struct queue_item_t* current_first = queue->lead->next;
+  newitem->before = queue->lead;
+  newitem->next = current_first;
+  queue->lead->next = newitem;
+  current_first->before = newitem;
+  newitem->item = item;
+  sem_post(&queue->mutex);
+  sem_post(&queue->length);
+}
+
+/**
+ * Removes the oldest item. Must only be called after `queue->length` was
+ * successfully decremented
+ */
+void* queue_remove_last(struct queue_t* queue) {
+  sem_wait(&queue->mutex);
+  struct queue_item_t* lead_last = queue->lead_last;
+  struct queue_item_t* oldlast = lead_last->before;
+  struct queue_item_t* newlast = oldlast->before;
+  newlast->next = lead_last;
+  lead_last->before = newlast;
+  sem_post(&queue->mutex);
+  void* item = oldlast->item;
+  free(oldlast);
+  return item;
+}
+
+// blocks until an item is available
+void* queue_pop(struct queue_t* queue) {
+  sem_wait(&queue->length);
+  return queue_remove_last(queue);
+}
+
+// returns NULL if the queue is empty
+void* queue_try_pop(struct queue_t* queue) {
+  if (sem_trywait(&queue->length) < 0) {
+    return NULL;
+  }
+  return queue_remove_last(queue);
+}
+
+// how many times an idle consumer polls the ring before going to sleep, when
+// there is more than one CPU to spin on
+const int RING_SPIN_COUNT = 1024;
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+struct ring_cell_t {
+  std::atomic<size_t> sequence;
+  void* item;
+};
+
+/**
+ * Bounded queue. `capacity` must be a power of two.
+ */
+struct ring_t {
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> enqueue_position;
+  alignas(CACHE_LINE_SIZE) std::atomic<size_t> dequeue_position;
+  /**
+   * Consumers sleeping (or about to) on `wakeup`
+   */
+  alignas(CACHE_LINE_SIZE) std::atomic<int> sleepers;
+  sem_t wakeup;
+  /**
+   * Read-only after ring_init
+   */
+  alignas(CACHE_LINE_SIZE) struct ring_cell_t* cells;
+  size_t mask;
+  /**
+   * RING_SPIN_COUNT, or 0 on a single CPU where spinning only delays the
+   * producer
+   */
+  int spin_count;
+};
+
+void ring_init(struct ring_t* ring, size_t capacity) {
+  ring->cells = new ring_cell_t[capacity];
+  ring->mask = capacity - 1;
+  ring->spin_count = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? RING_SPIN_COUNT : 0;
+  for (size_t i = 0; i < capacity; i++) {
+    ring->cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+  ring->enqueue_position.store(0, std::memory_order_relaxed);
+  ring->dequeue_position.store(0, std::memory_order_relaxed);
+  ring->sleepers.store(0, std::memory_order_relaxed);
+  sem_init(&ring->wakeup, 0, 0);
+}
+
+// returns false if the ring is full
+bool ring_try_push(struct ring_t* ring, void* item) {
+  struct ring_cell_t* cell;
+  size_t position = ring->enqueue_position.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &ring->cells[position & ring->mask];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+    if (difference == 0) {
+      if (ring->enqueue_position.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      return false;
+    } else {
+      position = ring->enqueue_position.load(std::memory_order_relaxed);
+    }
+  }
+  cell->item = item;
+  cell->sequence.store(position + 1, std::memory_order_release);
+
+  // pairs with the fence in ring_pop: either the consumer sees the item or
+  // we see the consumer asleep
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (ring->sleepers.load(std::memory_order_relaxed) > 0) {
+    sem_post(&ring->wakeup);
+  }
+  return true;
+}
+
+// spins until there is room. Only for producers whose consumers never block
+// on them
+void ring_push(struct ring_t* ring, void* item) {
+  while (!ring_try_push(ring, item)) {
+    sched_yield();
+  }
+}
+
+// returns NULL if the ring is empty
+void* ring_try_pop(struct ring_t* ring) {
+  struct ring_cell_t* cell;
+  size_t position = ring->dequeue_position.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &ring->cells[position & ring->mask];
+    size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+    if (difference == 0) {
+      if (ring->dequeue_position.compare_exchange_weak(
+              position, position + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (difference < 0) {
+      return NULL;
+    } else {
+      position = ring->dequeue_position.load(std::memory_order_relaxed);
+    }
+  }
+  void* item = cell->item;
+  cell->sequence.store(position + ring->mask + 1, std::memory_order_release);
+  return item;
+}
+
+/**
+ * How many items are queued. Only an estimate while producers or consumers
+ * are running
+ */
+inline size_t ring_size(struct ring_t* ring) {
+  size_t dequeued = ring->dequeue_position.load(std::memory_order_relaxed);
+  size_t enqueued = ring->enqueue_position.load(std::memory_order_relaxed);
+  return enqueued > dequeued ? enqueued - dequeued : 0;
+}
+
+// blocks until an item is available
+void* ring_pop(struct ring_t* ring) {
+  void* item;
+  while (true) {
+    for (int i = 0; i < ring->spin_count; i++) {
+      if ((item = ring_try_pop(ring)) != NULL) {
+        return item;
+      }
+      cpu_relax();
+    }
+    ring->sleepers.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    item = ring_try_pop(ring);
+    if (item == NULL) {
+      // a producer may post for an item some other consumer takes: waking
+      // up to an empty ring is harmless
+      sem_wait(&ring->wakeup);
+    }
+    ring->sleepers.fetch_sub(1, std::memory_order_relaxed);
+    if (item != NULL) {
+      return item;
+    }
+  }
+}
+
+#endif
@@ -0,0 +1,120 @@
+/**
+ * Usage: ./queue_benchmark [items]
+ *
+ * Compares the request queues of queue.h the way the server uses them: one
+ * producer (the event loop) hands `items` items to 1 to 64 consumers (the
+ * workers). Prints, for each queue and consumer count, the throughput and the
+ * average handoff latency, i.e. the time from the push until a consumer got
+ * the item.
+ *
+ * The producer never runs ahead by more than RING_CAPACITY items, for both
+ * queues, so that they are compared with the same amount of work queued.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <atomic>
+
+#include "queue.h"
+
+const int RING_CAPACITY = 1 << 12;
+const int MAX_CONSUMERS = 64;
+
+struct item_t {
+  uint64_t pushed_at;
+};
+
+inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct benchmark_t {
+  bool use_ring;
+  struct queue_t queue;
+  struct ring_t ring;
+  /**
+   * Consumers stop when they get this item
+   */
+  struct item_t stop;
+  alignas(CACHE_LINE_SIZE) std::atomic<long> consumed;
+  alignas(CACHE_LINE_SIZE) std::atomic<uint64_t> total_latency;
+};
+
+void* consumer(void* benchmark_arg) {
+  struct benchmark_t* benchmark = (struct benchmark_t*)benchmark_arg;
+  uint64_t total_latency = 0;
+  while (true) {
+    struct item_t* item =
+        (struct item_t*)(benchmark->use_ring ? ring_pop(&benchmark->ring)
+                                             : queue_pop(&benchmark->queue));
+    if (item == &benchmark->stop) {
+      break;
+    }
+    total_latency += now_ns() - item->pushed_at;
+    benchmark->consumed.fetch_add(1, std::memory_order_relaxed);
+  }
+  benchmark->total_latency += total_latency;
+  return NULL;
+}
+
+void run(bool use_ring, int consumer_count, long item_count) {
+  struct benchmark_t* benchmark = new benchmark_t;
+  benchmark->use_ring = use_ring;
+  queue_init(&benchmark->queue);
+  ring_init(&benchmark->ring, RING_CAPACITY);
+  benchmark->consumed = 0;
+  benchmark->total_latency = 0;
+  struct item_t* items = new item_t[RING_CAPACITY];
+
+  pthread_t consumers[MAX_CONSUMERS];
+  for (int i = 0; i < consumer_count; i++) {
+    pthread_create(&consumers[i], NULL, consumer, benchmark);
+  }
+
+  uint64_t start = now_ns();
+  for (long i = 0; i < item_count; i++) {
+    // an item is only reused once the consumers are RING_CAPACITY behind
+    while (i - benchmark->consumed.load(std::memory_order_relaxed) >=
+           RING_CAPACITY) {
+      sched_yield();
+    }
+    struct item_t* item = &items[i % RING_CAPACITY];
+    item->pushed_at = now_ns();
+    if (use_ring) {
+      ring_push(&benchmark->ring, item);
+    } else {
+      queue_push(&benchmark->queue, item);
+    }
+  }
+  for (int i = 0; i < consumer_count; i++) {
+    if (use_ring) {
+      ring_push(&benchmark->ring, &benchmark->stop);
+    } else {
+      queue_push(&benchmark->queue, &benchmark->stop);
+    }
+  }
+  for (int i = 0; i < consumer_count; i++) {
+    pthread_join(consumers[i], NULL);
+  }
+  uint64_t elapsed = now_ns() - start;
+
+  printf("%-7s %3d consumers: %10.0f items/s, %8.0f ns average handoff\n",
+         use_ring ? "ring_t" : "queue_t", consumer_count,
+         item_count * 1e9 / elapsed,
+         (double)benchmark->total_latency / benchmark->consumed);
+  delete[] benchmark->ring.cells;
+  delete[] items;
+  delete benchmark;
+}
+
+int main(int argc, char* argv[]) {
+  long item_count = argc > 1 ? atol(argv[1]) : 1000000;
+  for (int consumers = 1; consumers <= MAX_CONSUMERS; consumers *= 2) {
+    run(false, consumers, item_count);
+    run(true, consumers, item_count);
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef __ANYTIME_SOLVE__
+#define __ANYTIME_SOLVE__
+
+#include <algorithm>
+#include "solve.cpp"
+#include "twophase.cpp"
+
+// Trades latency against solution length per request: a solution comes first
+// from TwoPhaseSolver, in about a millisecond, then CubeSolver looks for a
+// shorter one until the time budget runs out.
+//
+// The optimal search only has to rule out the lengths below that of the
+// first solution: IDA* deepens one move at a time, so the first shorter
+// solution it finds is optimal, and once it exhausted every shorter length
+// the first solution is optimal too. Either way, it stops right there.
+struct AnytimeSolver {
+    CubeSolver solver;
+    TwoPhaseSolver two_phase_solver;
+
+    AnytimeSolver(PruningTable* table) : solver(table) {}
+
+    // the best solution found within `budget` nanoseconds. It is Solved
+    // unless the limits stopped the two-phase search too (`limits` bound the
+    // whole call, the budget only the search for a shorter solution). When
+    // the budget ran out first, the solution is not optimal, and no solution
+    // has searched_depth moves or fewer
+    CubeSolution solve(Permutation& cube,
+                       uint64_t budget,
+                       SolveLimits limits = SolveLimits{}) {
+        uint64_t started_at = SolveClock();
+        CubeSolution first = two_phase_solver.solve(cube, limits);
+        // a single move cannot be beaten but by the solved cube
+        if (first.status != Solved || first.length <= 1) {
+            first.optimal = first.status == Solved;
+            return first;
+        }
+
+        SolveLimits shorter_limits = limits;
+        uint64_t budget_deadline = started_at + budget;
+        shorter_limits.deadline =
+            limits.deadline == 0 ? budget_deadline
+                                 : std::min(limits.deadline, budget_deadline);
+        solver.max_length = first.length - 1;
+        CubeSolution shorter = solver.solve(cube, shorter_limits);
+        solver.max_length = 0;
+        shorter.nodes += first.nodes;
+        if (shorter.status == Solved || shorter.status == Cancelled) {
+            return shorter;
+        }
+        first.nodes = shorter.nodes;
+        first.searched_depth = shorter.searched_depth;
+        first.optimal = shorter.status == Exhausted;
+        return first;
+    }
+};
+
+#endif
@@ -0,0 +1,64 @@
+// Usage: ./buildtable [--threads=N] [--tables-only] [output]
+//
+// Builds the pruning table on N threads (one per CPU by default) and saves
+// it to `output`, pruning_table.bin by default. Prints how many entries each
+// depth has, which do not depend on the number of threads.
+//
+// Saves the tables derived at startup to table_bundle.bin, in the directory
+// of `output`, beforehand (see tablebundle.cpp). With --tables-only, it
+// stops there.
+#include <string.h>
+#include <thread>
+#include "pruningtable.cpp"
+#include "twophase.cpp"
+
+int main(int argc, char* argv[]) {
+    int thread_count = std::thread::hardware_concurrency();
+    bool tables_only = false;
+    string output = "pruning_table.bin";
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--threads=", 10) == 0) {
+            thread_count = atoi(argv[i] + 10);
+        } else if (strcmp(argv[i], "--tables-only") == 0) {
+            tables_only = true;
+        } else if (argv[i][0] == '-') {
+            cerr << "usage: " << argv[0]
+                 << " [--threads=N] [--tables-only] [output]" << endl;
+            return 1;
+        } else {
+            output = argv[i];
+        }
+    }
+    if (thread_count < 1) {
+        thread_count = 1;
+    }
+
+    size_t slash = output.rfind('/');
+    string bundle = (slash == string::npos ? "" : output.substr(0, slash + 1)) +
+                    TableBundleFile;
+    if (TableSourceHash == 0) {
+        cerr << "built without -DTABLE_SOURCE_HASH (see compile.sh): no "
+                "process will map "
+             << bundle << endl;
+    }
+    TableBundle& tables = GetTableBundle();
+    if (!tables.save(bundle)) {
+        cerr << "could not save " << bundle << endl;
+        return 1;
+    }
+    cout << "saved " << tables.table_count << " tables to " << bundle << endl;
+    if (tables_only) {
+        return 0;
+    }
+
+    PruningTable table;
+    table.allocate();
+    uint64_t count_per_depth[21];
+    table.build_parallel(thread_count, count_per_depth);
+    for (int d = 0; d < 21 && count_per_depth[d] > 0; d++) {
+        cout << "depth " << d << ": " << count_per_depth[d] << " entries"
+             << endl;
+    }
+    table.save_to_file(output);
+    return 0;
+}
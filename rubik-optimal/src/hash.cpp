@@ -1,11 +1,14 @@
 #ifndef __HASH__
 #define __HASH__
 
+#include <string.h>
 #include <string>
 #include "permutation.cpp"
 
 using namespace std;
 
+struct MalformedHash {};
+
 const string _face_color[6]{"b", "r", "w", "g", "o", "y"};
 
 string face2color(string face) {
@@ -253,113 +256,127 @@ string Hash(Permutation p) {
     return res;
 }
 
-int _corner_cubie_index(string name) {
-    for (int i = 0; i < 8; i++) {
-        if (CornerCubieName[i] == name) {
-            return i;
+// Where each cubie's facelets lie in a hash and which face each facelet
+// shows in every orientation of every cubie, derived once from the tables
+// Hash uses. A facelet is looked up by the faces of its center: corners by
+// their three faces (f0 * 36 + f1 * 6 + f2), edges by their two
+// (f0 * 6 + f1), each giving replaced_by | orientation << 4, or 0xFF
+struct _facelet_tables {
+    unsigned char corner_facelets[8][3];
+    unsigned char edge_facelets[12][2];
+    unsigned char center_facelets[6];
+    unsigned char corners[216];
+    unsigned char edges[36];
+};
+
+int _color_face(string color) {
+    for (int f = 0; f < 6; f++) {
+        if (_face_color[f] == color) {
+            return f;
         }
     }
+    return -1;
 }
 
-int _edge_cubie_index(string name) {
-    for (int i = 0; i < 12; i++) {
-        if (EdgeCubieName[i] == name) {
-            return i;
+_facelet_tables _build_facelet_tables() {
+    _facelet_tables res;
+    for (int i = 0; i < 54; i++) {
+        _cubie_face coord = hashindex2cubieface(i);
+        if (coord.is_corner) {
+            res.corner_facelets[coord.cubie][coord.rotation] = i;
+        } else if (coord.is_edge) {
+            res.edge_facelets[coord.cubie][coord.rotation] = i;
+        } else {
+            res.center_facelets[coord.cubie] = i;
         }
     }
-}
-
-int _face_index(char name) {
-    int index = 0;
-    for (auto i : {'U', 'R', 'F', 'D', 'L', 'B'}) {
-        if (i == name) {
-            return index;
+    memset(res.corners, 0xFF, sizeof(res.corners));
+    memset(res.edges, 0xFF, sizeof(res.edges));
+    // as in Hash: facelet r of a corner twisted by o shows anchor (r - o)
+    for (int c = 0; c < 8; c++) {
+        for (int o = 0; o < 3; o++) {
+            int key = 0;
+            for (int r = 0; r < 3; r++) {
+                key = key * 6 +
+                      _color_face(_anchor_hash.corners[c][(r + 3 - o) % 3]);
+            }
+            res.corners[key] = c | o << 4;
+        }
+    }
+    for (int e = 0; e < 12; e++) {
+        for (int o = 0; o < 2; o++) {
+            int key = _color_face(_anchor_hash.edges[e][o]) * 6 +
+                      _color_face(_anchor_hash.edges[e][1 - o]);
+            res.edges[key] = e | o << 4;
         }
-        index++;
     }
+    return res;
 }
 
-struct _facelets_cube {
-    char corners[8][3];
-    char edges[12][2];
-    char centers[6];
-    _facelets_cube(string colors)
-        : corners{{colors[8], colors[3 * 9], colors[2 * 9 + 2]},
-                  {colors[6], colors[2 * 9 + 0], colors[9 + 2]},
-                  {colors[5 * 9 + 2], colors[2 * 9 + 8], colors[3 * 9 + 6]},
-                  {colors[5 * 9], colors[9 + 8], colors[2 * 9 + 6]},
-                  {colors[2], colors[4 * 9], colors[3 * 9 + 2]},
-                  {colors[0], colors[9 + 0], colors[4 * 9 + 2]},
-                  {colors[5 * 9 + 8], colors[3 * 9 + 8], colors[4 * 9 + 6]},
-                  {colors[5 * 9 + 6], colors[4 * 9 + 8], colors[9 + 6]}},
-          edges{{colors[7], colors[2 * 9 + 1]},
-                {colors[5 * 9 + 1], colors[2 * 9 + 7]},
-                {colors[1], colors[4 * 9 + 1]},
-                {colors[5 * 9 + 7], colors[4 * 9 + 7]},
-                {colors[3], colors[9 + 1]},
-                {colors[5], colors[3 * 9 + 1]},
-                {colors[5 * 9 + 3], colors[9 + 7]},
-                {colors[5 * 9 + 5], colors[3 * 9 + 7]},
-                {colors[2 * 9 + 3], colors[9 + 5]},
-                {colors[4 * 9 + 3], colors[3 * 9 + 5]},
-                {colors[4 * 9 + 5], colors[9 + 3]},
-                {colors[2 * 9 + 5], colors[3 * 9 + 3]}},
-          centers{colors[4],         colors[3 * 9 + 4], colors[2 * 9 + 4],
-                  colors[5 * 9 + 4], colors[9 + 4],     colors[4 * 9 + 4]} {}
-};
+_facelet_tables _facelet_lookup = _build_facelet_tables();
 
-bool has(char array[], int length, char element) {
-    for (int i = 0; i < length; i++) {
-        if (array[i] == element) {
-            return true;
+// Reads the 54 facelets of a hash (any six colors, told apart by the
+// centers) into `cube`, without allocating. Returns false unless every
+// cubie shows up exactly once with colors a real cubie has. The cube may
+// still be unsolvable (see Permutation::is_solvable)
+bool Facelets2Permutation(const char* facelets, size_t length,
+                          Permutation* cube) {
+    if (length != 54) {
+        return false;
+    }
+    unsigned char face[256];
+    memset(face, 0xFF, sizeof(face));
+    for (int f = 0; f < 6; f++) {
+        unsigned char color = facelets[_facelet_lookup.center_facelets[f]];
+        if (face[color] != 0xFF) {
+            return false;
         }
+        face[color] = f;
     }
-    return false;
-}
 
-int indexOf(char array[], int length, char element) {
-    for (int i = 0; i < length; i++) {
-        if (array[i] == element) {
-            return i;
+    int corners_seen = 0;
+    for (int i = 0; i < CornerCubieLength; i++) {
+        const unsigned char* at = _facelet_lookup.corner_facelets[i];
+        int f0 = face[(unsigned char)facelets[at[0]]];
+        int f1 = face[(unsigned char)facelets[at[1]]];
+        int f2 = face[(unsigned char)facelets[at[2]]];
+        if ((f0 | f1 | f2) == 0xFF) {
+            return false;
         }
+        unsigned char cubie = _facelet_lookup.corners[f0 * 36 + f1 * 6 + f2];
+        if (cubie == 0xFF || (corners_seen & 1 << (cubie & 15))) {
+            return false;
+        }
+        corners_seen |= 1 << (cubie & 15);
+        cube->corners[i].replaced_by = cubie & 15;
+        cube->corners[i].orientation = cubie >> 4;
     }
-    return -1;
+
+    int edges_seen = 0;
+    for (int i = 0; i < EdgeCubieLength; i++) {
+        const unsigned char* at = _facelet_lookup.edge_facelets[i];
+        int f0 = face[(unsigned char)facelets[at[0]]];
+        int f1 = face[(unsigned char)facelets[at[1]]];
+        if ((f0 | f1) == 0xFF) {
+            return false;
+        }
+        unsigned char cubie = _facelet_lookup.edges[f0 * 6 + f1];
+        if (cubie == 0xFF || (edges_seen & 1 << (cubie & 15))) {
+            return false;
+        }
+        edges_seen |= 1 << (cubie & 15);
+        cube->edges[i].replaced_by = cubie & 15;
+        cube->edges[i].orientation = cubie >> 4;
+    }
+    return true;
 }
 
 Permutation Hash2Permutation(string hash) {
-    _facelets_cube cube{hash};
     Permutation res;
-    for (int i = 0; i < 8; i++) {
-        res.corners[i].replaced_by = _corner_cubie_index(
-            (string)(has(cube.corners[i], 3, cube.centers[_face_index('U')])
-                         ? "U"
-                         : "D") +
-            (has(cube.corners[i], 3, cube.centers[_face_index('R')]) ? "R"
-                                                                     : "L") +
-            (has(cube.corners[i], 3, cube.centers[_face_index('F')]) ? "F"
-                                                                     : "B"));
-        res.corners[i].orientation =
-            indexOf(cube.corners[i], 3,
-                    cube.centers[_face_index(
-                        CornerCubieName[res.corners[i].replaced_by][0])]);
-    }
-    for (int i = 0; i < 12; i++) {
-        string replaced_by = "";
-        for (auto face : {'U', 'D', 'L', 'R', 'F', 'B'}) {
-            if (has(cube.edges[i], 2, cube.centers[_face_index(face)])) {
-                replaced_by = replaced_by + face;
-            }
-        }
-        res.edges[i].replaced_by = _edge_cubie_index(replaced_by);
-        char anchor;
-        if (replaced_by[0] == 'L' || replaced_by[0] == 'R') {
-            anchor = cube.centers[_face_index(replaced_by[1])];
-        } else {
-            anchor = cube.centers[_face_index(replaced_by[0])];
-        }
-        res.edges[i].orientation = cube.edges[i][0] == anchor ? 0 : 1;
+    if (!Facelets2Permutation(hash.data(), hash.length(), &res)) {
+        throw MalformedHash{};
     }
     return res;
 }
 
-#endif
\ No newline at end of file
+#endif
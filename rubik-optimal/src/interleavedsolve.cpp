@@ -0,0 +1,106 @@
+#ifndef __INTERLEAVED_SOLVE__
+#define __INTERLEAVED_SOLVE__
+
+#include <vector>
+#include "solve.cpp"
+
+// Solves several cubes at once on one thread, to hide the latency of the
+// pruning table.
+//
+// Nearly every node of a search reads three entries of a table far larger
+// than any cache, so a lone search spends most of its time waiting for
+// memory. Here each of the lanes runs its own search with CubeSolver::step,
+// which prefetches the entries of a node and returns before reading them:
+// while one lane's entries are on their way, the other lanes step. A lane
+// takes the next cube as soon as its own is solved.
+//
+// With a complete pruning table on one core, 2 lanes search about 1.6 to
+// 1.9 times as many nodes per second as CubeSolver::solve, and 4 to 8 lanes
+// about 2 to 2.3 times (interleave_benchmark 8 8 4). A table which fits in
+// the caches gains nothing.
+struct InterleavedCubeSolver {
+    vector<CubeSolver*> lanes;
+
+    InterleavedCubeSolver(PruningTable* table, int lane_count) {
+        for (int i = 0; i < lane_count; i++) {
+            lanes.push_back(new CubeSolver(table));
+        }
+    }
+
+    ~InterleavedCubeSolver() {
+        for (auto lane : lanes) {
+            delete lane;
+        }
+    }
+
+    // solution[i] is that of cubes[i], as given by CubeSolver::solve. The
+    // limits apply to every cube
+    vector<CubeSolution> solve(vector<Permutation>& cubes,
+                               SolveLimits limits = SolveLimits{}) {
+        vector<CubeSolution> solutions(cubes.size(), CubeSolution{0});
+        /* the cube each lane solves, -1 once there are none left */
+        vector<int> lane_cube(lanes.size(), -1);
+        int next_cube = 0;
+        int busy_lanes = 0;
+        for (int l = 0; l < (int)lanes.size(); l++) {
+            lane_cube[l] = take_cube(lanes[l], cubes, solutions, limits,
+                                     &next_cube);
+            busy_lanes += lane_cube[l] >= 0;
+        }
+        while (busy_lanes > 0) {
+            for (int l = 0; l < (int)lanes.size(); l++) {
+                if (lane_cube[l] < 0) {
+                    continue;
+                }
+                CubeSolver* lane = lanes[l];
+                SearchStep result = lane->step();
+                if (result == Pending) {
+                    continue;
+                }
+                if (result == Found) {
+                    solutions[lane_cube[l]] = lane->found_solution();
+                } else {
+                    solutions[lane_cube[l]] = stopped(lane);
+                }
+                lane_cube[l] = take_cube(lane, cubes, solutions, limits,
+                                         &next_cube);
+                busy_lanes -= lane_cube[l] < 0;
+            }
+        }
+        return solutions;
+    }
+
+    // starts the lane on the next cube needing a search, and returns its
+    // index. -1 if there is none left
+    int take_cube(CubeSolver* lane,
+                  vector<Permutation>& cubes,
+                  vector<CubeSolution>& solutions,
+                  SolveLimits limits,
+                  int* next_cube) {
+        while (*next_cube < (int)cubes.size()) {
+            int cube = (*next_cube)++;
+            if (Permutation::equals(cubes[cube], Permutation::identity())) {
+                continue;
+            }
+            lane->begin(limits);
+            if (lane->limits_reached()) {
+                solutions[cube] = stopped(lane);
+                continue;
+            }
+            lane->begin_steps(cubes[cube]);
+            return cube;
+        }
+        return -1;
+    }
+
+    CubeSolution stopped(CubeSolver* lane) {
+        CubeSolution solution{0};
+        solution.status = lane->status;
+        solution.searched_depth = lane->boundary_depth;
+        solution.nodes = lane->node_count();
+        solution.stats = lane->stats;
+        return solution;
+    }
+};
+
+#endif
@@ -1,11 +1,48 @@
+#include <string.h>
+#include <algorithm>
+#include <iomanip>
 #include <thread>
+#include <type_traits>
 #include "assert.h"
+#include "anytimesolve.cpp"
 #include "coordinate.cpp"
 #include "hash.cpp"
+#include "interleavedsolve.cpp"
+#include "parallelsolve.cpp"
 #include "permutation.cpp"
 #include "pruningtable.cpp"
 #include "solve.cpp"
 #include "symmetry.cpp"
+#include "tablebundle.cpp"
+#include "twophase.cpp"
+
+// the cube which `moves` (CanonicalPermutation indexes) make of the solved one
+Permutation scrambled_cube(const vector<int>& moves) {
+    Permutation p = Permutation::identity();
+    for (int move : moves) {
+        p = Permutation::mult(p, CanonicalPermutation[move]);
+    }
+    return p;
+}
+
+// `moves` random moves from the solved cube. 40 of them make a random-state
+// cube, which mostly needs 17 or 18 moves
+Permutation random_cube(int moves) {
+    Permutation p = Permutation::identity();
+    for (int i = 0; i < moves; i++) {
+        p = Permutation::mult(
+            p, CanonicalPermutation[rand() % CanonicalPermutationLength]);
+    }
+    return p;
+}
+
+// whether the moves of `solution` bring `p` back to the solved cube
+bool solves(const CubeSolution& solution, Permutation p) {
+    for (int i = 0; i < solution.length; i++) {
+        p = Permutation::mult(p, solution.move(i));
+    }
+    return Permutation::equals(p, Permutation::identity());
+}
 
 void test_permutation() {
     assert(Permutation::equals(
@@ -40,6 +77,56 @@ void test_permutation() {
     assert(!Permutation::edge_permutation_is_even(p));
     p = Permutation::mult(p, CanonicalPermutation[D]);
     assert(Permutation::edge_permutation_is_even(p));
+
+    assert(Permutation::is_solvable(p));
+    p.corners[URF].orientation = G;
+    assert(!Permutation::is_solvable(p));
+    p.corners[URF].orientation = I;
+    p.edges[UF].replaced_by = UB;
+    p.edges[UB].replaced_by = UF;
+    assert(!Permutation::is_solvable(p));
+
+    // the register-wide mult and equals against the loops, reflections
+    // included
+    for (int c = 0; c < 1000; c++) {
+        Permutation a = FullSymmetry[rand() % FullSymmetryLength];
+        Permutation b = FullSymmetry[rand() % FullSymmetryLength];
+        for (int i = 0; i < 5; i++) {
+            a = Permutation::mult_scalar(
+                a, CanonicalPermutation[rand() % CanonicalPermutationLength]);
+            b = Permutation::mult_scalar(
+                CanonicalPermutation[rand() % CanonicalPermutationLength], b);
+        }
+        Permutation product = Permutation::mult(a, b);
+        assert(Permutation::equals_scalar(product,
+                                          Permutation::mult_scalar(a, b)));
+        assert(Permutation::equals(a, b) == Permutation::equals_scalar(a, b));
+        assert(Permutation::equals(a, a));
+        assert(!Permutation::equals(product, Permutation::mult(product, a)) ||
+               Permutation::equals(a, Permutation::identity()));
+    }
+
+    unsigned char moves[CanonicalPermutationLength];
+    string names = "";
+    for (int m = 0; m < CanonicalPermutationLength; m++) {
+        moves[m] = m;
+        names = names + CanonicalPermutationName[m] + " ";
+    }
+    char formatted[3 * CanonicalPermutationLength + 1];
+    int length = FormatMoveNames(moves, CanonicalPermutationLength, formatted,
+                                 sizeof(formatted));
+    assert(string(formatted, length) == names);
+    assert(FormatMoveNames(moves, 0, formatted, 0) == 0);
+    // exactly enough room, then one char short: nothing past it is written
+    int needed = names.length();
+    formatted[needed - 1] = '#';
+    assert(FormatMoveNames(moves, CanonicalPermutationLength, formatted,
+                           needed) == needed);
+    assert(string(formatted, needed) == names);
+    formatted[needed - 1] = '#';
+    assert(FormatMoveNames(moves, CanonicalPermutationLength, formatted,
+                           needed - 1) == -1);
+    assert(formatted[needed - 1] == '#');
 }
 
 void test_coordinate() {
@@ -72,6 +159,12 @@ void test_coordinate() {
         assert(CornerPermutationCoordinate(perm) == i);
     }
 
+    // too many to go through all of them
+    for (int i = 0; i < EdgePermutationCoordinateLength; i += 9973) {
+        perm = EdgePermutationCoordinateInverse(i);
+        assert(EdgePermutationCoordinate(perm) == i);
+    }
+
     for (int i = 0; i < FBSliceSortedCoordinateLength; i++) {
         perm = FBSliceSortedCoordinateInverse(i);
         assert(FBSliceSortedCoordinate(perm) == i);
@@ -169,6 +262,36 @@ void test_symmetry() {
                 FullSymmetryConjugate(CanonicalPermutation[m], i)));
         }
     }
+
+    // symmetric cubes (identity, half turns, superflip-like ones) included
+    vector<Permutation> cubes = {
+        Permutation::identity(),
+        Permutation::mult(CanonicalPermutation[U2], CanonicalPermutation[D2]),
+        Permutation::mult_vector({CanonicalPermutation[U2],
+                                  CanonicalPermutation[D2],
+                                  CanonicalPermutation[R2],
+                                  CanonicalPermutation[L2]})};
+    for (int c = 0; c < 200; c++) {
+        cubes.push_back(random_cube(c % 12));
+    }
+    int fixed = 0;
+    for (Permutation& p : cubes) {
+        for (int i = 0; i < FullSymmetryLength; i++) {
+            bool commutes = Permutation::commutes(FullSymmetry[i], p);
+            assert(commutes ==
+                   Permutation::equals(p, FullSymmetryConjugate(p, i)));
+            fixed += commutes;
+        }
+        assert(Permutation::equals(
+            FBConjugate(p),
+            Permutation::mult_vector({SymmetryS_R4i, p, SymmetryS_R4})));
+        assert(Permutation::equals(
+            LRConjugate(p),
+            Permutation::mult_vector({SymmetryS_R4i, FundamentalSymmetry[S_U4],
+                                      p, InverseSymmetry[S_U4],
+                                      SymmetryS_R4})));
+    }
+    assert(fixed > 48 * 3);
 }
 
 void test_move_table() {
@@ -263,8 +386,8 @@ void test_pruning_table() {
         assert(table.get(1, 0, i) == (i % 3 == 0 ? 3 : i % 3));
     }
     table.deallocate();
-    table.allocate();
-    table.load_from_file("pruning_table.bin");
+    assert(!table.load_from_file("no_such_pruning_table.bin"));
+    assert(table.load_from_file("pruning_table.bin"));
     assert(table.get_real(0, 0, 0) == 0);
     int corner = CornerOrientationMove[0][R];
     int edge = EdgeOrientationMove[0][R];
@@ -273,6 +396,52 @@ void test_pruning_table() {
     assert(table.get_real(ud, edge, corner) == 1);
 }
 
+void test_real_depth_batch() {
+    PruningTable table;
+    table.load_from_file("pruning_table.bin");
+    for (int c = 0; c < 100; c++) {
+        Permutation p = random_cube(c % 9);
+        int coords[3] = {
+            SymUDSliceSortedCoordinate(p),
+            UDSliceSortedRaw2Sym[FBSliceSortedCoordinate(p)][0],
+            UDSliceSortedRaw2Sym[LRSliceSortedCoordinate(p)][0]};
+        int edges[3] = {EdgeOrientationCoordinate(p),
+                        FBEdgeOrientationCoordinate(p),
+                        LREdgeOrientationCoordinate(p)};
+        int corners[3] = {CornerOrientationCoordinate(p),
+                          FBCornerOrientationCoordinate(p),
+                          LRCornerOrientationCoordinate(p)};
+        int depths[3];
+        table.get_real_batch(3, coords, edges, corners, depths);
+        for (int axis = 0; axis < 3; axis++) {
+            assert(depths[axis] == table.get_real_simpl(coords[axis],
+                                                        edges[axis],
+                                                        corners[axis]));
+        }
+        table.get_real_batch(1, coords + 2, edges + 2, corners + 2, depths);
+        assert(depths[0] == table.get_real_simpl(coords[2], edges[2],
+                                                 corners[2]));
+    }
+}
+
+void test_parallel_build() {
+    // the first depths only: a full build takes hours
+    const int depth = 4;
+    PruningTable serial;
+    serial.allocate();
+    uint64_t serial_counts[21];
+    serial.build(serial_counts, depth);
+    PruningTable parallel;
+    parallel.allocate();
+    uint64_t parallel_counts[21];
+    parallel.build_parallel(3, parallel_counts, depth);
+    for (int d = 0; d < 21; d++) {
+        assert(serial_counts[d] == parallel_counts[d]);
+    }
+    assert(serial_counts[depth] > 0 && serial_counts[depth + 1] == 0);
+    assert(memcmp(serial._table, parallel._table, PruningTable::size()) == 0);
+}
+
 void test_hash() {
     for (int m = 0; m < CanonicalPermutationLength; m++) {
         assert(Permutation::equals(
@@ -284,6 +453,316 @@ void test_hash() {
             assert(Permutation::equals(p, Hash2Permutation(Hash(p))));
         }
     }
+
+    Permutation p = random_cube(20);
+    string hash = Hash(p);
+    Permutation q;
+    // colors are told apart by the centers only
+    string recolored = hash;
+    for (char& c : recolored) {
+        c = "URFDLB"[_color_face(string(1, c))];
+    }
+    assert(Facelets2Permutation(recolored.data(), 54, &q));
+    assert(Permutation::equals(p, q));
+
+    assert(!Facelets2Permutation(hash.data(), 53, &q));
+    string bad = hash;
+    bad[0] = 'x';
+    assert(!Facelets2Permutation(bad.data(), 54, &q));
+    bad = hash;
+    bad[4] = bad[13];
+    assert(!Facelets2Permutation(bad.data(), 54, &q));
+    // a mirrored corner: two facelets of URF swapped
+    bad = hash;
+    swap(bad[8], bad[27]);
+    assert(!Facelets2Permutation(bad.data(), 54, &q));
+    // URF painted as ULF, which then shows up twice
+    bad = Hash(Permutation::identity());
+    bad[27] = bad[22];
+    bad[20] = bad[13];
+    assert(!Facelets2Permutation(bad.data(), 54, &q));
+    // a flipped edge is a well-formed, unsolvable cube
+    bad = Hash(Permutation::identity());
+    swap(bad[7], bad[19]);
+    assert(Facelets2Permutation(bad.data(), 54, &q));
+    assert(!Permutation::is_solvable(q));
+}
+
+void test_solve_limits() {
+    PruningTable table;
+    table.load_from_file("pruning_table.bin");
+    CubeSolver solver{&table};
+    Permutation p = Permutation::mult_vector(
+        {CanonicalPermutation[U], CanonicalPermutation[R2],
+         CanonicalPermutation[Fi]});
+
+    SolveLimits expired;
+    expired.deadline = 1;
+    CubeSolution solution = solver.solve(p, expired);
+    assert(solution.status == TimedOut);
+    assert(solution.length == 0 && solution.searched_depth == 0);
+
+    std::atomic<bool> cancelled{true};
+    SolveLimits cancelling;
+    cancelling.cancelled = &cancelled;
+    assert(solver.solve(p, cancelling).status == Cancelled);
+
+    cancelled = false;
+    cancelling.deadline = SolveClock() + 60000000000UL;
+    solution = solver.solve(p, cancelling);
+    assert(solution.status == Solved && solution.length == 3);
+}
+
+void test_parallel_solve() {
+    PruningTable table;
+    table.load_from_file("pruning_table.bin");
+    CubeSolver solver{&table};
+    ParallelCubeSolver parallel{&table, 3};
+    // split even the shortest searches across the threads
+    parallel.min_length = 3;
+    vector<vector<int>> scrambles = {
+        {U, R2, Fi}, {R, U, Ri, Ui, F2}, {L, D2, Bi, R, F, Ui, B2}};
+    for (auto& scramble : scrambles) {
+        Permutation p = scrambled_cube(scramble);
+        CubeSolution expected = solver.solve(p);
+        CubeSolution solution = parallel.solve(p);
+        assert(solution.status == Solved);
+        assert(solution.length == expected.length);
+        assert(solves(solution, p));
+    }
+
+    std::atomic<bool> cancelled{true};
+    SolveLimits cancelling;
+    cancelling.cancelled = &cancelled;
+    Permutation p = Permutation::mult(CanonicalPermutation[U],
+                                      CanonicalPermutation[R2]);
+    assert(parallel.solve(p, cancelling).status == Cancelled);
+}
+
+void test_interleaved_solve() {
+    PruningTable table;
+    table.load_from_file("pruning_table.bin");
+    CubeSolver solver{&table};
+    InterleavedCubeSolver interleaved{&table, 3};
+    vector<vector<int>> scrambles = {{U, R2, Fi},
+                                     {},
+                                     {R, U, Ri, Ui, F2},
+                                     {L, D2, Bi, R, F, Ui, B2},
+                                     {F},
+                                     {D, L2, B, Ri}};
+    vector<Permutation> cubes;
+    for (auto& scramble : scrambles) {
+        cubes.push_back(scrambled_cube(scramble));
+    }
+    vector<CubeSolution> solutions = interleaved.solve(cubes);
+    assert(solutions.size() == cubes.size());
+    for (int c = 0; c < cubes.size(); c++) {
+        CubeSolution expected = solver.solve(cubes[c]);
+        assert(solutions[c].status == Solved);
+        assert(solutions[c].length == expected.length);
+        assert(solutions[c].nodes == expected.nodes);
+        assert(solves(solutions[c], cubes[c]));
+    }
+
+    SolveLimits expired;
+    expired.deadline = 1;
+    solutions = interleaved.solve(cubes, expired);
+    assert(solutions[0].status == TimedOut);
+    assert(solutions[1].status == Solved && solutions[1].length == 0);
+}
+
+void test_inverse_heuristic() {
+    PruningTable table;
+    table.load_from_file("pruning_table.bin");
+    CubeSolver solver{&table};
+    CubeSolver inverse_solver{&table};
+    inverse_solver.use_inverse = true;
+    vector<vector<int>> scrambles = {{U, R2, Fi},
+                                     {R, U, Ri, Ui, F2},
+                                     {L, D2, Bi, R, F, Ui, B2},
+                                     {F, R, U2, Li, B, D, R2, Ui}};
+    for (auto& scramble : scrambles) {
+        Permutation p = scrambled_cube(scramble);
+        assert(Permutation::equals(
+            Permutation::mult(p, Permutation::inverse(p)),
+            Permutation::identity()));
+        CubeSolution expected = solver.solve(p);
+        CubeSolution solution = inverse_solver.solve(p);
+        assert(solution.status == Solved);
+        assert(solution.length == expected.length);
+        assert(solution.nodes <= expected.nodes);
+        assert(solves(solution, p));
+    }
+}
+
+void test_two_phase() {
+    TwoPhaseSolver solver;
+    vector<vector<int>> scrambles = {{},
+                                     {U, R2, Fi},
+                                     {R, U, Ri, Ui, F2},
+                                     {L, D2, Bi, R, F, Ui, B2}};
+    vector<Permutation> cubes;
+    for (auto& scramble : scrambles) {
+        cubes.push_back(scrambled_cube(scramble));
+    }
+    for (int c = 0; c < 20; c++) {
+        cubes.push_back(random_cube(40));
+    }
+    for (int c = 0; c < cubes.size(); c++) {
+        CubeSolution solution = solver.solve(cubes[c]);
+        assert(solution.status == Solved);
+        assert(c >= scrambles.size() || solution.length <= TwoPhaseMaxLength);
+        assert(solves(solution, cubes[c]));
+    }
+
+    // no solution is that short: a longer one comes instead
+    solver.max_length = 4;
+    CubeSolution solution = solver.solve(cubes[3]);
+    assert(solution.status == Solved && solution.length > 4);
+    // nor is any solution looked for past SolutionMaxLength
+    solver.max_length = SolutionMaxLength + 1;
+    assert(solver.solve(cubes[3]).status == Exhausted);
+    solver.max_length = TwoPhaseMaxLength;
+
+    std::atomic<bool> cancelled{true};
+    SolveLimits cancelling;
+    cancelling.cancelled = &cancelled;
+    assert(solver.solve(cubes[3], cancelling).status == Cancelled);
+}
+
+void test_anytime_solve() {
+    PruningTable table;
+    table.load_from_file("pruning_table.bin");
+    CubeSolver solver{&table};
+    AnytimeSolver anytime{&table};
+    vector<vector<int>> scrambles = {{},
+                                     {F},
+                                     {U, R2, Fi},
+                                     {R, U, Ri, Ui, F2},
+                                     {L, D2, Bi, R, F, Ui, B2}};
+    for (auto& scramble : scrambles) {
+        Permutation p = scrambled_cube(scramble);
+        CubeSolution expected = solver.solve(p);
+        // enough time to prove optimality
+        CubeSolution solution = anytime.solve(p, 60000000000UL);
+        assert(solution.status == Solved && solution.optimal);
+        assert(solution.length == expected.length);
+        // no time for anything but the first solution
+        CubeSolution first = anytime.solve(p, 0);
+        assert(first.status == Solved);
+        assert(first.length >= expected.length);
+        assert(first.optimal == (first.length <= 1));
+        assert(solves(first, p));
+    }
+
+    // the optimal search alone gives up past max_length
+    Permutation p = Permutation::mult_vector(
+        {CanonicalPermutation[U], CanonicalPermutation[R2],
+         CanonicalPermutation[Fi]});
+    solver.max_length = 2;
+    CubeSolution solution = solver.solve(p);
+    assert(solution.status == Exhausted && solution.searched_depth == 2);
+    // fewer nodes than SolveCheckInterval are counted too
+    assert(solution.nodes > 0);
+    solver.max_length = 0;
+
+    std::atomic<bool> cancelled{true};
+    SolveLimits cancelling;
+    cancelling.cancelled = &cancelled;
+    assert(anytime.solve(p, 60000000000UL, cancelling).status == Cancelled);
+}
+
+void test_search_stats() {
+    PruningTable table;
+    table.load_from_file("pruning_table.bin");
+    CubeSolver solver{&table};
+    ParallelCubeSolver parallel{&table, 3};
+    parallel.min_length = 3;
+    vector<vector<int>> scrambles = {
+        {U, R2, Fi}, {R, U, Ri, Ui, F2}, {L, D2, Bi, R, F, Ui, B2}};
+    for (auto& scramble : scrambles) {
+        Permutation p = scrambled_cube(scramble);
+        for (int s = 0; s < 2; s++) {
+            CubeSolution solution =
+                s == 0 ? solver.solve(p) : parallel.solve(p);
+#ifdef SOLVE_STATS
+            uint64_t generated = 0;
+            for (int d = 0; d < SolveStatsDepths; d++) {
+                generated += solution.stats.generated[d];
+                assert(solution.stats.expanded[d] <=
+                       solution.stats.generated[d]);
+                // the last iteration looks for solutions of `length` moves
+                assert(d < solution.length ||
+                       solution.stats.generated[d] == 0);
+            }
+            assert(generated == solution.nodes);
+            assert(solution.stats.table_lookups == 3 * generated);
+            assert(solution.stats.generated[solution.length - 1] > 0);
+            assert(solution.stats.pruned_axis +
+                       solution.stats.pruned_exponent >
+                   0);
+#else
+            assert(solution.status == Solved);
+#endif
+        }
+    }
+#ifndef SOLVE_STATS
+    // solutions carry no stats at all
+    static_assert(std::is_empty<SolveStats>::value,
+                  "SolveStats is only filled with SOLVE_STATS");
+#endif
+}
+
+void test_table_bundle() {
+    TableBundle& tables = GetTableBundle();
+    assert(tables.table_count >= 20);
+    assert(tables.save("test_table_bundle.bin"));
+
+    TableBundle bundle;
+    assert(bundle.open("test_table_bundle.bin"));
+    for (int i = 0; i < tables.table_count; i++) {
+        const char* found = bundle.find(tables.tables[i].name,
+                                        tables.tables[i].size);
+        assert(found != nullptr && (uintptr_t)found % 64 == 0);
+        assert(memcmp(found, tables.table_data[i], tables.tables[i].size) ==
+               0);
+        assert(bundle.find(tables.tables[i].name,
+                           tables.tables[i].size + 1) == nullptr);
+    }
+    assert(bundle.find("NoSuchTable", 1) == nullptr);
+    bundle.close_mapping();
+
+    // a corrupt table is rebuilt, the others are still used
+    fstream file("test_table_bundle.bin", ios::in | ios::out | ios::binary);
+    TableBundleHeader header;
+    file.read((char*)&header, sizeof(header));
+    file.seekp(header.entries[0].offset);
+    file.put(~tables.table_data[0][0]);
+    file.close();
+    assert(bundle.open("test_table_bundle.bin"));
+    assert(bundle.find(header.entries[0].name, header.entries[0].size) ==
+           nullptr);
+    assert(bundle.find(header.entries[1].name, header.entries[1].size) !=
+           nullptr);
+    bundle.close_mapping();
+
+    // a bundle of another version is not used at all
+    header.version = TableBundleVersion + 1;
+    file.open("test_table_bundle.bin", ios::in | ios::out | ios::binary);
+    file.write((char*)&header, sizeof(header));
+    file.close();
+    assert(!bundle.open("test_table_bundle.bin"));
+    assert(bundle.find(header.entries[1].name, header.entries[1].size) ==
+           nullptr);
+
+    // nor is one saved from other table sources
+    header.version = TableBundleVersion;
+    header.source_hash = TableSourceHash + 1;
+    file.open("test_table_bundle.bin", ios::in | ios::out | ios::binary);
+    file.write((char*)&header, sizeof(header));
+    file.close();
+    assert(!bundle.open("test_table_bundle.bin"));
+    remove("test_table_bundle.bin");
 }
 
 void test_all() {
@@ -291,8 +770,18 @@ void test_all() {
     test_coordinate();
     test_symmetry();
     test_pruning_table();
+    test_real_depth_batch();
+    test_parallel_build();
     test_move_table();
     test_hash();
+    test_solve_limits();
+    test_parallel_solve();
+    test_interleaved_solve();
+    test_inverse_heuristic();
+    test_two_phase();
+    test_anytime_solve();
+    test_search_stats();
+    test_table_bundle();
 }
 
 bool stripequals(string text, int start, string target) {
@@ -366,10 +855,439 @@ string parse_hash(string text, int* start_index) {
     return res;
 }
 
+// solves `count` random cubes with `solver` and with a ParallelCubeSolver of
+// `threads` threads, comparing times and solution lengths. Random-state cubes
+// stand in for a corpus of depth 17-20 positions: most need 17 or 18 moves,
+// few 19 and hardly any 20. No speedup has been measured yet, since that needs
+// a machine with several cores
+void parallel_benchmark(PruningTable* table,
+                        CubeSolver& solver,
+                        int threads,
+                        int count) {
+    ParallelCubeSolver parallel{table, threads};
+    double serial_total = 0;
+    double parallel_total = 0;
+    for (int c = 0; c < count; c++) {
+        Permutation p = random_cube(40);
+        uint64_t start = SolveClock();
+        CubeSolution expected = solver.solve(p);
+        uint64_t middle = SolveClock();
+        CubeSolution solution = parallel.solve(p);
+        uint64_t end = SolveClock();
+        double serial_time = (middle - start) / 1e9;
+        double parallel_time = (end - middle) / 1e9;
+        serial_total += serial_time;
+        parallel_total += parallel_time;
+        cout << "length " << solution.length << ": serial " << serial_time
+             << "s, parallel " << parallel_time << "s, speedup "
+             << serial_time / parallel_time << endl;
+        if (solution.length != expected.length) {
+            cout << "length mismatch, serial found " << expected.length << endl;
+        }
+    }
+    cout << "total: serial " << serial_total << "s, parallel "
+         << parallel_total << "s, speedup " << serial_total / parallel_total
+         << endl
+         << endl;
+}
+
+// solves `count` random cubes with `solver`, then with InterleavedCubeSolver
+// for 1, 2, 4... up to `max_lanes` lanes, comparing nodes per second. With
+// `seconds` > 0, each cube is searched that long at most (n lanes share n
+// times as long for n cubes), since optimal solutions can take minutes each
+void interleave_benchmark(PruningTable* table,
+                          CubeSolver& solver,
+                          int count,
+                          int max_lanes,
+                          double seconds) {
+    vector<Permutation> cubes;
+    for (int c = 0; c < count; c++) {
+        cubes.push_back(random_cube(40));
+    }
+    // `n` cubes' worth of search time from now, or no limit
+    auto limits_for = [seconds](int n) {
+        SolveLimits limits;
+        if (seconds > 0) {
+            limits.deadline = SolveClock() + (uint64_t)(seconds * n * 1e9);
+        }
+        return limits;
+    };
+    uint64_t nodes = 0;
+    uint64_t start = SolveClock();
+    for (auto& cube : cubes) {
+        nodes += solver.solve(cube, limits_for(1)).nodes;
+    }
+    double serial_rate = nodes / ((SolveClock() - start) / 1e9);
+    cout << "serial: " << serial_rate / 1e6 << " Mnodes/s" << endl;
+    for (int lanes = 1; lanes <= max_lanes; lanes *= 2) {
+        InterleavedCubeSolver interleaved{table, lanes};
+        nodes = 0;
+        start = SolveClock();
+        // without limits, every lane takes the next cube of the whole lot
+        int batch_size = seconds > 0 ? lanes : count;
+        for (int first = 0; first < count; first += batch_size) {
+            vector<Permutation> batch(
+                cubes.begin() + first,
+                cubes.begin() + min(first + batch_size, count));
+            for (auto& solution :
+                 interleaved.solve(batch, limits_for(batch.size()))) {
+                nodes += solution.nodes;
+            }
+        }
+        double rate = nodes / ((SolveClock() - start) / 1e9);
+        cout << lanes << " lanes: " << rate / 1e6 << " Mnodes/s, speedup "
+             << rate / serial_rate << endl;
+    }
+    cout << endl;
+}
+
+// solves `count` random cubes with and without the inverse heuristic,
+// comparing nodes and times
+void inverse_benchmark(PruningTable* table, int count) {
+    CubeSolver solver{table};
+    CubeSolver inverse_solver{table};
+    inverse_solver.use_inverse = true;
+    uint64_t nodes_total[2] = {0, 0};
+    double time_total[2] = {0, 0};
+    for (int c = 0; c < count; c++) {
+        Permutation p = random_cube(40);
+        uint64_t start = SolveClock();
+        CubeSolution expected = solver.solve(p);
+        uint64_t middle = SolveClock();
+        CubeSolution solution = inverse_solver.solve(p);
+        uint64_t end = SolveClock();
+        nodes_total[0] += expected.nodes;
+        nodes_total[1] += solution.nodes;
+        time_total[0] += (middle - start) / 1e9;
+        time_total[1] += (end - middle) / 1e9;
+        cout << "length " << solution.length << ": nodes " << expected.nodes
+             << " -> " << solution.nodes << ", time "
+             << (middle - start) / 1e9 << "s -> " << (end - middle) / 1e9
+             << "s" << endl;
+        if (solution.length != expected.length) {
+            cout << "length mismatch, without inverse " << expected.length
+                 << endl;
+        }
+    }
+    cout << "total: nodes " << nodes_total[0] << " -> " << nodes_total[1]
+         << " (" << (double)nodes_total[0] / nodes_total[1] << "x fewer), time "
+         << time_total[0] << "s -> " << time_total[1] << "s (speedup "
+         << time_total[0] / time_total[1] << ")" << endl
+         << endl;
+}
+
+// solves `count` random cubes with TwoPhaseSolver, reporting times and
+// solution lengths
+void two_phase_benchmark(int count) {
+    TwoPhaseSolver solver;
+    vector<double> times;
+    int lengths[31] = {0};
+    for (int c = 0; c < count; c++) {
+        Permutation p = random_cube(40);
+        uint64_t start = SolveClock();
+        CubeSolution solution = solver.solve(p);
+        times.push_back((SolveClock() - start) / 1e6);
+        lengths[min(solution.length, 30)]++;
+    }
+    sort(times.begin(), times.end());
+    double total = 0;
+    for (double time : times) {
+        total += time;
+    }
+    cout << "average " << total / count << "ms, median " << times[count / 2]
+         << "ms, 99th percentile " << times[count * 99 / 100]
+         << "ms, slowest " << times[count - 1] << "ms" << endl;
+    cout << "lengths:";
+    for (int i = 0; i <= 30; i++) {
+        if (lengths[i] > 0) {
+            cout << " " << i << " moves x" << lengths[i];
+        }
+    }
+    cout << endl << endl;
+}
+
+// solves `count` random cubes with AnytimeSolver, `budget_ms` milliseconds
+// each, reporting times, solution lengths and how many were proven optimal
+void anytime_benchmark(PruningTable* table, int count, int budget_ms) {
+    AnytimeSolver solver{table};
+    double total = 0;
+    int proven = 0;
+    int lengths[31] = {0};
+    for (int c = 0; c < count; c++) {
+        Permutation p = random_cube(40);
+        uint64_t start = SolveClock();
+        CubeSolution solution = solver.solve(p, budget_ms * 1000000UL);
+        total += (SolveClock() - start) / 1e6;
+        lengths[min(solution.length, 30)]++;
+        proven += solution.optimal ? 1 : 0;
+    }
+    cout << "average " << total / count << "ms, proven optimal " << proven
+         << " of " << count << endl;
+    cout << "lengths:";
+    for (int i = 0; i <= 30; i++) {
+        if (lengths[i] > 0) {
+            cout << " " << i << " moves x" << lengths[i];
+        }
+    }
+    cout << endl << endl;
+}
+
+// times the exact depths of the three axes of `count` random cubes, as the
+// search starts with them: walked one after the other with get_real_simpl,
+// then together with get_real_batch
+void real_depth_benchmark(PruningTable* table, int count) {
+    vector<int> coords, edges, corners;
+    for (int c = 0; c < count; c++) {
+        Permutation p = random_cube(40);
+        coords.push_back(SymUDSliceSortedCoordinate(p));
+        coords.push_back(UDSliceSortedRaw2Sym[FBSliceSortedCoordinate(p)][0]);
+        coords.push_back(UDSliceSortedRaw2Sym[LRSliceSortedCoordinate(p)][0]);
+        edges.push_back(EdgeOrientationCoordinate(p));
+        edges.push_back(FBEdgeOrientationCoordinate(p));
+        edges.push_back(LREdgeOrientationCoordinate(p));
+        corners.push_back(CornerOrientationCoordinate(p));
+        corners.push_back(FBCornerOrientationCoordinate(p));
+        corners.push_back(LRCornerOrientationCoordinate(p));
+    }
+    uint64_t total = 0;
+    uint64_t start = SolveClock();
+    for (int i = 0; i < 3 * count; i++) {
+        total += table->get_real_simpl(coords[i], edges[i], corners[i]);
+    }
+    double serial_time = (SolveClock() - start) / 1e3 / count;
+    int depths[3];
+    start = SolveClock();
+    for (int c = 0; c < count; c++) {
+        table->get_real_batch(3, &coords[3 * c], &edges[3 * c],
+                              &corners[3 * c], depths);
+        total -= depths[0] + depths[1] + depths[2];
+    }
+    double batch_time = (SolveClock() - start) / 1e3 / count;
+    cout << "per cube: get_real_simpl " << serial_time
+         << "us, get_real_batch " << batch_time << "us, speedup "
+         << serial_time / batch_time << endl;
+    if (total != 0) {
+        cout << "depth mismatch" << endl;
+    }
+    cout << endl;
+}
+
+#ifdef SOLVE_STATS
+void print_search_stats(SolveStats& stats) {
+    cout << "depth   generated    expanded     time (s)" << endl;
+    for (int d = 0; d < SolveStatsDepths; d++) {
+        if (stats.generated[d] == 0 && stats.iteration_ns[d] == 0) {
+            continue;
+        }
+        cout << setw(5) << d << setw(12) << stats.generated[d] << setw(12)
+             << stats.expanded[d] << setw(13) << stats.iteration_ns[d] / 1e9
+             << endl;
+    }
+    cout << "pruned: axis " << stats.pruned_axis << ", exponent "
+         << stats.pruned_exponent << ", symmetry " << stats.pruned_symmetry
+         << ", neighbour axis " << stats.pruned_neighbour_axis << ", inverse "
+         << stats.pruned_inverse << endl;
+    cout << "table lookups " << stats.table_lookups << ", setup "
+         << stats.setup_ns / 1e9 << "s" << endl;
+}
+
+// solves `count` random cubes with `solver` and prints what the searches
+// did, added up
+void search_stats(CubeSolver& solver, int count) {
+    SolveStats total;
+    for (int c = 0; c < count; c++) {
+        Permutation p = random_cube(40);
+        total.add(solver.solve(p).stats);
+    }
+    print_search_stats(total);
+    cout << endl;
+}
+#else
+void search_stats(CubeSolver&, int) {
+    cout << "search_stats needs a build with -DSOLVE_STATS" << endl << endl;
+}
+#endif
+
+// times `count` products and comparisons of random cubes, with the
+// register-wide mult and equals and with the loops
+void permutation_benchmark(int count) {
+    vector<Permutation> cubes;
+    for (int c = 0; c < 1024; c++) {
+        Permutation symmetry = FullSymmetry[rand() % FullSymmetryLength];
+        cubes.push_back(Permutation::mult(symmetry, random_cube(20)));
+    }
+    // each product feeds the next one, as in mult_vector
+    Permutation p = Permutation::identity();
+    uint64_t start = SolveClock();
+    for (int i = 0; i < count; i++) {
+        p = Permutation::mult(p, cubes[i & 1023]);
+    }
+    double mult_time = (double)(SolveClock() - start) / count;
+    Permutation q = Permutation::identity();
+    start = SolveClock();
+    for (int i = 0; i < count; i++) {
+        q = Permutation::mult_scalar(q, cubes[i & 1023]);
+    }
+    double scalar_time = (double)(SolveClock() - start) / count;
+    int same = 0;
+    start = SolveClock();
+    for (int i = 0; i < count; i++) {
+        same += Permutation::equals(cubes[i & 1023], cubes[(i >> 10) & 1023]);
+    }
+    double equals_time = (double)(SolveClock() - start) / count;
+    start = SolveClock();
+    for (int i = 0; i < count; i++) {
+        same -= Permutation::equals_scalar(cubes[i & 1023],
+                                           cubes[(i >> 10) & 1023]);
+    }
+    double equals_scalar_time = (double)(SolveClock() - start) / count;
+    cout << "sizeof(Permutation) " << sizeof(Permutation) << " bytes" << endl;
+    cout << "mult " << mult_time << "ns, loops " << scalar_time
+         << "ns, speedup " << scalar_time / mult_time << endl;
+    cout << "equals " << equals_time << "ns, loops " << equals_scalar_time
+         << "ns, speedup " << equals_scalar_time / equals_time << endl;
+    if (!Permutation::equals_scalar(p, q) || same != 0) {
+        cout << "mismatch" << endl;
+    }
+    cout << endl;
+}
+
+// `table` with its rows and columns swapped: [move * rows + coordinate]
+uint16_t* move_major(MoveTable table, int rows) {
+    uint16_t* res = new uint16_t[rows * CanonicalPermutationLength];
+    for (int c = 0; c < rows; c++) {
+        for (int m = 0; m < CanonicalPermutationLength; m++) {
+            res[m * rows + c] = table[c][m];
+        }
+    }
+    return res;
+}
+
+// the move-major copies of the tables which move_coordinates_walk reads
+uint16_t* CornerPermutationMoveMajor;
+uint16_t* EdgeOrientationMoveMajor;
+uint16_t* CornerOrientationMoveMajor;
+
+template <bool MoveMajor>
+inline int move_table_lookup(MoveTable table,
+                             uint16_t* move_major_table,
+                             int rows,
+                             int coordinate,
+                             int move) {
+    return MoveMajor ? move_major_table[move * rows + coordinate]
+                     : table[coordinate][move];
+}
+
+// looks up the corner permutation and the three edge and corner orientations
+// of every move below `coords` down to `depth`, as CubeSolver's
+// move_coordinates would without pruning. Returns a checksum
+template <bool MoveMajor>
+uint64_t move_coordinates_walk(const int* coords, int depth) {
+    uint64_t sum = coords[0] + coords[2] + coords[6];
+    if (depth == 0) {
+        return sum;
+    }
+    int next[7];
+    for (int m = 0; m < CanonicalPermutationLength; m++) {
+        int moves[3] = {m, FullCanonicalPermutationConjugate[m][fb_transform],
+                        FullCanonicalPermutationConjugate[m][lr_transform]};
+        next[0] = move_table_lookup<MoveMajor>(
+            CornerPermutationMove, CornerPermutationMoveMajor,
+            CornerPermutationCoordinateLength, coords[0], m);
+        for (int axis = 0; axis < 3; axis++) {
+            next[1 + axis] = move_table_lookup<MoveMajor>(
+                EdgeOrientationMove, EdgeOrientationMoveMajor,
+                EdgeOrientationCoordinateLength, coords[1 + axis],
+                moves[axis]);
+            next[4 + axis] = move_table_lookup<MoveMajor>(
+                CornerOrientationMove, CornerOrientationMoveMajor,
+                CornerOrientationCoordinateLength, coords[4 + axis],
+                moves[axis]);
+        }
+        sum += move_coordinates_walk<MoveMajor>(next, depth - 1);
+    }
+    return sum;
+}
+
+// walks every move sequence of `depth` moves from `count` random cubes,
+// looking up the move tables as they are (one row per coordinate) and with
+// their rows and columns swapped (one row per move)
+void move_table_benchmark(int count, int depth) {
+    CornerPermutationMoveMajor = move_major(CornerPermutationMove,
+                                            CornerPermutationCoordinateLength);
+    EdgeOrientationMoveMajor =
+        move_major(EdgeOrientationMove, EdgeOrientationCoordinateLength);
+    CornerOrientationMoveMajor =
+        move_major(CornerOrientationMove, CornerOrientationCoordinateLength);
+    vector<int> coords;
+    for (int c = 0; c < count; c++) {
+        Permutation p = random_cube(40);
+        coords.insert(coords.end(), {CornerPermutationCoordinate(p),
+                                     EdgeOrientationCoordinate(p),
+                                     FBEdgeOrientationCoordinate(p),
+                                     LREdgeOrientationCoordinate(p),
+                                     CornerOrientationCoordinate(p),
+                                     FBCornerOrientationCoordinate(p),
+                                     LRCornerOrientationCoordinate(p)});
+    }
+    double nodes = 0;
+    double width = count;
+    for (int d = 0; d <= depth; d++) {
+        nodes += width;
+        width *= CanonicalPermutationLength;
+    }
+    uint64_t start = SolveClock();
+    uint64_t sum = 0;
+    for (int c = 0; c < count; c++) {
+        sum += move_coordinates_walk<false>(&coords[7 * c], depth);
+    }
+    double state_major_rate = nodes / ((SolveClock() - start) / 1e9);
+    start = SolveClock();
+    for (int c = 0; c < count; c++) {
+        sum -= move_coordinates_walk<true>(&coords[7 * c], depth);
+    }
+    double move_major_rate = nodes / ((SolveClock() - start) / 1e9);
+    cout << "row per coordinate " << state_major_rate / 1e6
+         << " Mnodes/s, row per move " << move_major_rate / 1e6
+         << " Mnodes/s, speedup " << state_major_rate / move_major_rate
+         << endl;
+    if (sum != 0) {
+        cout << "mismatch" << endl;
+    }
+    delete[] CornerPermutationMoveMajor;
+    delete[] EdgeOrientationMoveMajor;
+    delete[] CornerOrientationMoveMajor;
+    cout << endl;
+}
+
+// times the parsing of `count` hashes of random cubes
+void parse_benchmark(int count) {
+    vector<string> hashes;
+    for (int c = 0; c < 1024; c++) {
+        hashes.push_back(Hash(random_cube(20)));
+    }
+    Permutation p;
+    int parsed = 0;
+    uint64_t start = SolveClock();
+    for (int i = 0; i < count; i++) {
+        const string& hash = hashes[i & 1023];
+        parsed += Facelets2Permutation(hash.data(), hash.length(), &p);
+    }
+    double elapsed = (double)(SolveClock() - start) / count;
+    cout << "parse " << elapsed << "ns, " << 1e9 / elapsed
+         << " cubes/s on one core" << endl;
+    if (parsed != count) {
+        cout << "rejected " << count - parsed << " hashes" << endl;
+    }
+    cout << endl;
+}
+
 void solve_loop() {
     PruningTable table;
-    table.allocate();
-    table.load_from_file("pruning_table.bin");
+    if (!table.load_from_file("pruning_table.bin")) {
+        cout << "could not load pruning_table.bin" << endl;
+        return;
+    }
 
     CubeSolver solver{&table};
 
@@ -382,16 +1300,103 @@ void solve_loop() {
         CubeSolution solution{0};
         getline(cin, requested_moves);
         int start = 0;
-        if (stripequals(requested_moves, 0, "hash_solve")) {
+        if (stripequals(requested_moves, 0, "parallel_benchmark")) {
+            // parallel_benchmark <threads> <cubes>
+            int threads = 2;
+            int count = 10;
+            sscanf(requested_moves.c_str() +
+                       ((string) "parallel_benchmark").length(),
+                   "%d %d", &threads, &count);
+            parallel_benchmark(&table, solver, threads, count);
+        } else if (stripequals(requested_moves, 0, "interleave_benchmark")) {
+            // interleave_benchmark <cubes> <max lanes> [seconds per cube]
+            int count = 10;
+            int max_lanes = 16;
+            double seconds = 0;
+            sscanf(requested_moves.c_str() +
+                       ((string) "interleave_benchmark").length(),
+                   "%d %d %lf", &count, &max_lanes, &seconds);
+            interleave_benchmark(&table, solver, count, max_lanes, seconds);
+        } else if (stripequals(requested_moves, 0, "inverse_benchmark")) {
+            // inverse_benchmark <cubes>
+            int count = 10;
+            sscanf(requested_moves.c_str() +
+                       ((string) "inverse_benchmark").length(),
+                   "%d", &count);
+            inverse_benchmark(&table, count);
+        } else if (stripequals(requested_moves, 0, "two_phase_benchmark")) {
+            // two_phase_benchmark <cubes>
+            int count = 100;
+            sscanf(requested_moves.c_str() +
+                       ((string) "two_phase_benchmark").length(),
+                   "%d", &count);
+            if (count > 0) {
+                two_phase_benchmark(count);
+            }
+        } else if (stripequals(requested_moves, 0, "anytime_benchmark")) {
+            // anytime_benchmark <cubes> <budget ms>
+            int count = 10;
+            int budget_ms = 100;
+            sscanf(requested_moves.c_str() +
+                       ((string) "anytime_benchmark").length(),
+                   "%d %d", &count, &budget_ms);
+            if (count > 0) {
+                anytime_benchmark(&table, count, budget_ms);
+            }
+        } else if (stripequals(requested_moves, 0, "real_depth_benchmark")) {
+            // real_depth_benchmark <cubes>
+            int count = 1000;
+            sscanf(requested_moves.c_str() +
+                       ((string) "real_depth_benchmark").length(),
+                   "%d", &count);
+            if (count > 0) {
+                real_depth_benchmark(&table, count);
+            }
+        } else if (stripequals(requested_moves, 0, "search_stats")) {
+            // search_stats <cubes>
+            int count = 10;
+            sscanf(requested_moves.c_str() +
+                       ((string) "search_stats").length(),
+                   "%d", &count);
+            search_stats(solver, count);
+        } else if (stripequals(requested_moves, 0, "permutation_benchmark")) {
+            // permutation_benchmark <operations>
+            int count = 10000000;
+            sscanf(requested_moves.c_str() +
+                       ((string) "permutation_benchmark").length(),
+                   "%d", &count);
+            if (count > 0) {
+                permutation_benchmark(count);
+            }
+        } else if (stripequals(requested_moves, 0, "move_table_benchmark")) {
+            // move_table_benchmark <cubes> <depth>
+            int count = 20;
+            int depth = 5;
+            sscanf(requested_moves.c_str() +
+                       ((string) "move_table_benchmark").length(),
+                   "%d %d", &count, &depth);
+            if (count > 0 && depth >= 0) {
+                move_table_benchmark(count, depth);
+            }
+        } else if (stripequals(requested_moves, 0, "parse_benchmark")) {
+            // parse_benchmark <hashes>
+            int count = 10000000;
+            sscanf(requested_moves.c_str() +
+                       ((string) "parse_benchmark").length(),
+                   "%d", &count);
+            if (count > 0) {
+                parse_benchmark(count);
+            }
+        } else if (stripequals(requested_moves, 0, "hash_solve")) {
             start = ((string) "hash_solve").length();
             string hash = parse_hash(requested_moves, &start);
             cout << "recognized permutation: " << hash << endl;
             p = Hash2Permutation(hash);
             solution = solver.solve(p);
             for (int i = 0; i < solution.length; i++) {
-                p = Permutation::mult(p, solution.moves[i]);
+                p = Permutation::mult(p, solution.move(i));
             }
-            cout << "solution: " << solution.move_names << endl << endl;
+            cout << "solution: " << solution.move_names() << endl << endl;
 
         }
         // not lowercase means move input
@@ -410,9 +1415,13 @@ void solve_loop() {
             }
             solution = solver.solve(p);
             for (int i = 0; i < solution.length; i++) {
-                p = Permutation::mult(p, solution.moves[i]);
+                p = Permutation::mult(p, solution.move(i));
             }
-            cout << solution.move_names << endl << endl;
+            cout << solution.move_names() << endl;
+#ifdef SOLVE_STATS
+            print_search_stats(solution.stats);
+#endif
+            cout << endl;
             moves.clear();
         } else if (stripequals(requested_moves, 0, "hash")) {
             start = ((string) "hash").length();
@@ -2,11 +2,9 @@
 #define __MOVETABLE__
 #include "coordinate.cpp"
 
-int** _build_corner_orientation_move() {
-    int** res = new int*[CornerOrientationCoordinateLength];
-    for (int i = 0; i < CornerOrientationCoordinateLength; i++) {
-        res[i] = new int[CanonicalPermutationLength];
-    }
+MoveTable _build_corner_orientation_move() {
+    MoveTable res = _allocate_table<CanonicalPermutationLength>(
+        CornerOrientationCoordinateLength);
     Permutation p;
     for (int i = 0; i < CornerOrientationCoordinateLength; i++) {
         for (int j = 0; j < CanonicalPermutationLength; j++) {
@@ -19,15 +17,16 @@ int** _build_corner_orientation_move() {
     return res;
 }
 
-// int[corner orientation coord length][canonical move count]. Returns the
-// coordinate of the result
-int** CornerOrientationMove = _build_corner_orientation_move();
+// uint16_t[corner orientation coord length][canonical move count]. Returns
+// the coordinate of the result
+MoveTable CornerOrientationMove = BundledTable<MoveTable>(
+    "CornerOrientationMove",
+    _table_size<CanonicalPermutationLength>(CornerOrientationCoordinateLength),
+    _build_corner_orientation_move);
 
-int** _build_edge_orientation_move() {
-    int** res = new int*[EdgeOrientationCoordinateLength];
-    for (int i = 0; i < EdgeOrientationCoordinateLength; i++) {
-        res[i] = new int[CanonicalPermutationLength];
-    }
+MoveTable _build_edge_orientation_move() {
+    MoveTable res = _allocate_table<CanonicalPermutationLength>(
+        EdgeOrientationCoordinateLength);
     Permutation p;
     for (int i = 0; i < EdgeOrientationCoordinateLength; i++) {
         for (int j = 0; j < CanonicalPermutationLength; j++) {
@@ -40,15 +39,16 @@ int** _build_edge_orientation_move() {
     return res;
 }
 
-// int[edge orientation coord length][canonical move count]. Returns the
+// uint16_t[edge orientation coord length][canonical move count]. Returns the
 // coordinate of the result
-int** EdgeOrientationMove = _build_edge_orientation_move();
+MoveTable EdgeOrientationMove = BundledTable<MoveTable>(
+    "EdgeOrientationMove",
+    _table_size<CanonicalPermutationLength>(EdgeOrientationCoordinateLength),
+    _build_edge_orientation_move);
 
-int** _build_sym_ud_slice_sorted_representant_move() {
-    int** res = new int*[UDSliceSortedClassCount];
-    for (int i = 0; i < UDSliceSortedClassCount; i++) {
-        res[i] = new int[CanonicalPermutationLength];
-    }
+MoveTable _build_sym_ud_slice_sorted_representant_move() {
+    MoveTable res =
+        _allocate_table<CanonicalPermutationLength>(UDSliceSortedClassCount);
 
     Permutation perm;
     for (int i = 0; i < UDSliceSortedClassCount; i++) {
@@ -63,10 +63,12 @@ int** _build_sym_ud_slice_sorted_representant_move() {
     return res;
 }
 
-// int[equivalence class count][canonical permutation length]. Returns the "sym
-// coordinate" of the move result
-int** SymUDSliceSortedRepresentantMove =
-    _build_sym_ud_slice_sorted_representant_move();
+// uint16_t[equivalence class count][canonical permutation length]. Returns the
+// "sym coordinate" of the move result
+MoveTable SymUDSliceSortedRepresentantMove = BundledTable<MoveTable>(
+    "SymUDSliceSortedRepresentantMove",
+    _table_size<CanonicalPermutationLength>(UDSliceSortedClassCount),
+    _build_sym_ud_slice_sorted_representant_move);
 
 // Returns the sym coordinate of the result
 inline int SymUDSliceSortedMove(int sym_coord, int canonical_move) {
@@ -90,11 +92,9 @@ inline int SymUDSliceSortedMove(int sym_coord, int canonical_move) {
     return j1 * SymmetryLength + i2;
 }
 
-int** _build_corner_permutation_move() {
-    int** res = new int*[CornerPermutationCoordinateLength];
-    for (int i = 0; i < CornerPermutationCoordinateLength; i++) {
-        res[i] = new int[CanonicalPermutationLength];
-    }
+MoveTable _build_corner_permutation_move() {
+    MoveTable res = _allocate_table<CanonicalPermutationLength>(
+        CornerPermutationCoordinateLength);
     Permutation inv, moved;
     for (int i = 0; i < CornerPermutationCoordinateLength; i++) {
         inv = CornerPermutationCoordinateInverse(i);
@@ -106,13 +106,14 @@ int** _build_corner_permutation_move() {
     return res;
 }
 
-int** CornerPermutationMove = _build_corner_permutation_move();
+MoveTable CornerPermutationMove = BundledTable<MoveTable>(
+    "CornerPermutationMove",
+    _table_size<CanonicalPermutationLength>(CornerPermutationCoordinateLength),
+    _build_corner_permutation_move);
 
-int** _build_fb_slice_sorted_move() {
-    int** res = new int*[FBSliceSortedCoordinateLength];
-    for (int i = 0; i < FBSliceSortedCoordinateLength; i++) {
-        res[i] = new int[CanonicalPermutationLength];
-    }
+MoveTable _build_fb_slice_sorted_move() {
+    MoveTable res = _allocate_table<CanonicalPermutationLength>(
+        FBSliceSortedCoordinateLength);
     Permutation inv, moved;
     for (int i = 0; i < FBSliceSortedCoordinateLength; i++) {
         inv = FBSliceSortedCoordinateInverse(i);
@@ -124,13 +125,14 @@ int** _build_fb_slice_sorted_move() {
     return res;
 }
 
-int** FBSliceSortedMove = _build_fb_slice_sorted_move();
+MoveTable FBSliceSortedMove = BundledTable<MoveTable>(
+    "FBSliceSortedMove",
+    _table_size<CanonicalPermutationLength>(FBSliceSortedCoordinateLength),
+    _build_fb_slice_sorted_move);
 
-int** _build_lr_slice_sorted_move() {
-    int** res = new int*[LRSliceSortedCoordinateLength];
-    for (int i = 0; i < LRSliceSortedCoordinateLength; i++) {
-        res[i] = new int[CanonicalPermutationLength];
-    }
+MoveTable _build_lr_slice_sorted_move() {
+    MoveTable res = _allocate_table<CanonicalPermutationLength>(
+        LRSliceSortedCoordinateLength);
     Permutation inv, moved;
     for (int i = 0; i < LRSliceSortedCoordinateLength; i++) {
         inv = LRSliceSortedCoordinateInverse(i);
@@ -142,6 +144,9 @@ int** _build_lr_slice_sorted_move() {
     return res;
 }
 
-int** LRSliceSortedMove = _build_lr_slice_sorted_move();
+MoveTable LRSliceSortedMove = BundledTable<MoveTable>(
+    "LRSliceSortedMove",
+    _table_size<CanonicalPermutationLength>(LRSliceSortedCoordinateLength),
+    _build_lr_slice_sorted_move);
 
 #endif
\ No newline at end of file
@@ -15,7 +15,6 @@ struct Work {
 
 PruningTable* _get_pruning_table() {
     PruningTable* table = new PruningTable();
-    table->allocate();
     table->load_from_file("pruning_table.bin");
     return table;
 }
@@ -26,7 +25,7 @@ static void WorkAsync(uv_work_t* req) {
     Work* work = static_cast<Work*>(req->data);
     CubeSolver solver{pruning_table};
     CubeSolution solution = solver.solve(*work->scrambled_cube);
-    work->solution_moves = solution.move_names;
+    work->solution_moves = solution.move_names();
 }
 
 static void WorkAsyncComplete(uv_work_t* req, int status) {
@@ -0,0 +1,267 @@
+#ifndef __PARALLEL_SOLVE__
+#define __PARALLEL_SOLVE__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "solve.cpp"
+
+// IDA* iterations looking for solutions of fewer moves than this are searched
+// by the calling thread alone: they are over before helpers would wake up
+const int ParallelMinLength = 10;
+
+// the first two moves of a solution fix the subtree a task searches
+struct SubtreeTask {
+    int moves[2];
+};
+
+// Searches one cube with several threads, each one with its own CubeSolver
+// over the same (read-only) PruningTable.
+//
+// Every IDA* iteration is split into one task per admissible pair of first
+// moves, which the threads take in turn. The first thread to find a solution
+// stops the others at their next check of the limits: since the previous
+// iteration found nothing, any solution of this one is optimal.
+struct ParallelCubeSolver {
+    /* solvers[0] belongs to the calling thread, solvers[i] to helpers[i-1] */
+    vector<CubeSolver*> solvers;
+    vector<std::thread> helpers;
+    /* at least 3: a task needs a move beyond its two-move prefix */
+    int min_length = ParallelMinLength;
+
+    std::mutex lock;
+    std::condition_variable work_ready;
+    std::condition_variable work_done;
+    /* bumped for every iteration handed to the helpers */
+    uint64_t generation = 0;
+    int busy_helpers = 0;
+    bool shutting_down = false;
+
+    /* the current iteration */
+    vector<SubtreeTask> tasks;
+    std::atomic<int> next_task{0};
+    std::atomic<bool> found{false};
+    int boundary = 0;
+    /* the solver which found the solution */
+    int winner = 0;
+
+    ParallelCubeSolver(PruningTable* table, int thread_count) {
+        for (int i = 0; i < thread_count; i++) {
+            solvers.push_back(new CubeSolver(table));
+        }
+        for (int i = 1; i < thread_count; i++) {
+            helpers.push_back(std::thread(&ParallelCubeSolver::help, this, i));
+        }
+    }
+
+    ~ParallelCubeSolver() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            shutting_down = true;
+        }
+        work_ready.notify_all();
+        for (auto& helper : helpers) {
+            helper.join();
+        }
+        for (auto solver : solvers) {
+            delete solver;
+        }
+    }
+
+    // whether the search descends into `next`, with `remaining` moves left
+    // after the one leading to it. Mirrors the pruning of CubeSolver::search
+    static bool admissible(CubeState* next, int remaining) {
+        if (remaining > 0 && next->ud_pruning == next->lr_pruning &&
+            next->ud_pruning == next->fb_pruning) {
+            return next->ud_pruning <= remaining - 1;
+        }
+        return next->ud_pruning <= remaining &&
+               next->fb_pruning <= remaining && next->lr_pruning <= remaining;
+    }
+
+    // the tasks of the iteration looking for solutions of boundary + 1 moves,
+    // in the order the serial search would visit them
+    void plan(int boundary) {
+        tasks.clear();
+        CubeSolver* solver = solvers[0];
+        CubeState* root = &solver->states[0];
+        CubeState* child = root + 1;
+        for (int axis = U; axis <= B; axis++) {
+            for (int exponent = 1; exponent < 4; exponent++) {
+                int first = AxisExponent2Move[axis][exponent];
+                if ((root->equal_by_sequence & GreaterBy[first]) != 0UL) {
+                    continue;
+                }
+                solver->current = root;
+                solver->execute_move(child, first);
+                if (!admissible(child, boundary)) {
+                    continue;
+                }
+                child->equal_by_sequence =
+                    root->equal_by_sequence & EqualBy[first];
+                for (int axis2 = U; axis2 <= B; axis2++) {
+                    // the serial search skips UU, U2U, DU, D2U, etc.
+                    if (axis2 == axis || axis2 + 3 == axis) {
+                        continue;
+                    }
+                    for (int exponent2 = 1; exponent2 < 4; exponent2++) {
+                        int second = AxisExponent2Move[axis2][exponent2];
+                        if ((child->equal_by_sequence & GreaterBy[second]) !=
+                            0UL) {
+                            continue;
+                        }
+                        solver->current = child;
+                        solver->execute_move(child + 1, second);
+                        if (admissible(child + 1, boundary - 1)) {
+                            tasks.push_back(SubtreeTask{{first, second}});
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    void run_tasks(int index) {
+        CubeSolver* solver = solvers[index];
+        while (!found.load(std::memory_order_relaxed)) {
+            int task = next_task.fetch_add(1);
+            if (task >= (int)tasks.size()) {
+                return;
+            }
+            if (solver->search_subtree(tasks[task].moves, 2, boundary)) {
+                bool expected = false;
+                if (found.compare_exchange_strong(expected, true)) {
+                    winner = index;
+                }
+                return;
+            }
+            if (solver->status != Solved) {
+                // deadline or cancellation
+                return;
+            }
+        }
+    }
+
+    void help(int index) {
+        uint64_t seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(lock);
+                work_ready.wait(guard, [&] {
+                    return shutting_down || generation != seen;
+                });
+                if (shutting_down) {
+                    return;
+                }
+                seen = generation;
+            }
+            run_tasks(index);
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                busy_helpers--;
+            }
+            work_done.notify_one();
+        }
+    }
+
+    // true iff the iteration found a solution
+    bool run_iteration(int boundary) {
+        plan(boundary);
+        this->boundary = boundary;
+        next_task = 0;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            busy_helpers = helpers.size();
+            generation++;
+        }
+        work_ready.notify_all();
+        run_tasks(0);
+        std::unique_lock<std::mutex> guard(lock);
+        work_done.wait(guard, [&] { return busy_helpers == 0; });
+        return found;
+    }
+
+    CubeSolution solve(Permutation& cube) {
+        return solve(cube, SolveLimits{});
+    }
+
+    // same as CubeSolver::solve
+    CubeSolution solve(Permutation& cube, SolveLimits limits) {
+        if (Permutation::equals(cube, Permutation::identity())) {
+            CubeSolution solution{0};
+            return solution;
+        }
+        found = false;
+        limits.finished = &found;
+        for (auto solver : solvers) {
+            solver->begin(limits);
+        }
+        CubeSolver* coordinator = solvers[0];
+        if (coordinator->limits_reached()) {
+            return stopped(0);
+        }
+        coordinator->reinitialize(cube);
+        for (auto solver : solvers) {
+            solver->states[0] = coordinator->states[0];
+        }
+
+        for (int boundary = 0;; boundary++) {
+            bool solved;
+            if (boundary + 1 < min_length || helpers.empty()) {
+                winner = 0;
+                solved = coordinator->search_subtree(nullptr, 0, boundary);
+            } else {
+                solved = run_iteration(boundary);
+            }
+            if (solved) {
+                CubeSolution solution = solvers[winner]->found_solution();
+                solution.nodes = node_count();
+                solution.stats = stats();
+                return solution;
+            }
+            for (auto solver : solvers) {
+                if (solver->status != Solved) {
+                    return stopped(boundary);
+                }
+            }
+        }
+    }
+
+    uint64_t node_count() {
+        uint64_t nodes = 0;
+        for (auto solver : solvers) {
+            nodes += solver->node_count();
+        }
+        return nodes;
+    }
+
+    // those of every solver, added up
+    SolveStats stats() {
+        SolveStats stats;
+        if (SolveStatsEnabled) {
+            for (auto solver : solvers) {
+                stats.add(solver->stats);
+            }
+        }
+        return stats;
+    }
+
+    // no solution has `searched_depth` moves or fewer
+    CubeSolution stopped(int searched_depth) {
+        CubeSolution solution{0};
+        solution.status = Cancelled;
+        for (auto solver : solvers) {
+            if (solver->status == TimedOut) {
+                solution.status = TimedOut;
+            }
+        }
+        solution.searched_depth = searched_depth;
+        solution.nodes = node_count();
+        solution.stats = stats();
+        return solution;
+    }
+};
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef __PERMUTATION__
 #define __PERMUTATION__
 
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+#include <string.h>
 #include <iostream>
 #include <vector>
 using namespace std;
@@ -41,27 +45,104 @@ enum EdgeCubieIndex {
 const string EdgeCubieName[12] = {"UF", "DF", "UB", "DB", "UL", "UR",
                                   "DL", "DR", "LF", "RB", "LB", "RF"};
 
+// One byte for where the cubie comes from and one for its orientation: the
+// 8 corners fill one 128-bit register, and the 12 edges one and a half
 struct CubiePermutation {
-    unsigned short int replaced_by;
-    unsigned short int orientation;
+    unsigned char replaced_by;
+    unsigned char orientation;
 };
 
 // Orientations are: I, G, G2, Re, GRe, G2Re (Re is "refletido", G is "girado no
 // sentido horário" and I is "identidade"). These are only for corners (edges
 // are simple mod2 arithmetic)
 enum CornerOrientation { I, G, G2, Re, GRe, G2Re };
-unsigned short int orientation_sum[][6] = {
+unsigned char orientation_sum[][6] = {
     {0, 1, 2, 3, 4, 5}, {1, 2, 0, 4, 5, 3}, {2, 0, 1, 5, 3, 4},
     {3, 5, 4, 0, 2, 1}, {4, 3, 5, 1, 0, 2}, {5, 4, 3, 2, 1, 0}};
 
-// Possible performance bottleneck: copying done by mult and equals
+#ifdef __SSSE3__
+// orientation_sum[a][b] at a * 6 + b, padded to three registers
+alignas(16) const unsigned char _orientation_sum_flat[48] = {
+    0, 1, 2, 3, 4, 5, 1, 2, 0, 4, 5, 3, 2, 0, 1, 5, 3, 4, 3, 5, 4, 0, 2, 1,
+    4, 3, 5, 1, 0, 2, 5, 4, 3, 2, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+#endif
+
+// Built with SSSE3 (-mssse3 or later), mult and equals work on whole
+// registers: mult gathers the cubies of `a` with pshufb, at indexes taken
+// from `b`. Otherwise they loop over the cubies, as mult_scalar and
+// equals_scalar do
 struct Permutation {
     CubiePermutation corners[CornerCubieLength];
     CubiePermutation edges[EdgeCubieLength];
-    static Permutation mult(const Permutation a, const Permutation b) {
+
+    static Permutation mult(const Permutation& a, const Permutation& b) {
+#ifdef __SSSE3__
+        Permutation res;
+        const __m128i pair_first = _mm_setr_epi8(0, 0, 2, 2, 4, 4, 6, 6, 8, 8,
+                                                 10, 10, 12, 12, 14, 14);
+        const __m128i pair_offset =
+            _mm_setr_epi8(0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1);
+        const __m128i orientations = _mm_set1_epi16((short)0xFF00);
+        const __m128i fifteen = _mm_set1_epi8(15);
+        const __m128i sixteen = _mm_set1_epi8(16);
+
+        // corners: res[i] = a[b[i].replaced_by], orientations summed
+        __m128i b_corners = _mm_loadu_si128((const __m128i*)b.corners);
+        __m128i index = _mm_shuffle_epi8(b_corners, pair_first);
+        index = _mm_add_epi8(_mm_add_epi8(index, index), pair_offset);
+        __m128i gathered = _mm_shuffle_epi8(
+            _mm_loadu_si128((const __m128i*)a.corners), index);
+        // orientation_sum, looked up at gathered * 6 + b, at most 35
+        __m128i twice = _mm_add_epi8(gathered, gathered);
+        __m128i sum = _mm_add_epi8(
+            _mm_add_epi8(_mm_add_epi8(twice, twice), twice), b_corners);
+        __m128i summed = _mm_or_si128(
+            _mm_or_si128(
+                _mm_shuffle_epi8(
+                    _mm_load_si128((const __m128i*)_orientation_sum_flat),
+                    _mm_or_si128(sum, _mm_cmpgt_epi8(sum, fifteen))),
+                _mm_shuffle_epi8(
+                    _mm_load_si128(
+                        (const __m128i*)(_orientation_sum_flat + 16)),
+                    _mm_or_si128(_mm_sub_epi8(sum, sixteen),
+                                 _mm_cmpgt_epi8(sum, _mm_set1_epi8(31))))),
+            _mm_shuffle_epi8(
+                _mm_load_si128((const __m128i*)(_orientation_sum_flat + 32)),
+                _mm_sub_epi8(sum, _mm_set1_epi8(32))));
+        _mm_storeu_si128(
+            (__m128i*)res.corners,
+            _mm_or_si128(_mm_andnot_si128(orientations, gathered),
+                         _mm_and_si128(orientations, summed)));
+
+        // edges, over two registers: res[i] = a[b[i].replaced_by], with
+        // orientations xor-ed
+        __m128i a_low = _mm_loadu_si128((const __m128i*)a.edges);
+        __m128i a_high = _mm_loadl_epi64((const __m128i*)(a.edges + 8));
+        __m128i b_halves[2] = {
+            _mm_loadu_si128((const __m128i*)b.edges),
+            _mm_loadl_epi64((const __m128i*)(b.edges + 8))};
+        __m128i res_halves[2];
+        for (int h = 0; h < 2; h++) {
+            index = _mm_shuffle_epi8(b_halves[h], pair_first);
+            index = _mm_add_epi8(_mm_add_epi8(index, index), pair_offset);
+            gathered = _mm_or_si128(
+                _mm_shuffle_epi8(
+                    a_low, _mm_or_si128(index, _mm_cmpgt_epi8(index, fifteen))),
+                _mm_shuffle_epi8(a_high, _mm_sub_epi8(index, sixteen)));
+            res_halves[h] = _mm_xor_si128(
+                gathered, _mm_and_si128(orientations, b_halves[h]));
+        }
+        _mm_storeu_si128((__m128i*)res.edges, res_halves[0]);
+        _mm_storel_epi64((__m128i*)(res.edges + 8), res_halves[1]);
+        return res;
+#else
+        return mult_scalar(a, b);
+#endif
+    }
+    static Permutation mult_scalar(const Permutation& a, const Permutation& b) {
         Permutation res;
         // corners
-        for (unsigned short int i = URF; i <= DLB; i++) {
+        for (int i = URF; i <= DLB; i++) {
             // calc replaced_by
             res.corners[i].replaced_by =
                 a.corners[b.corners[i].replaced_by].replaced_by;
@@ -71,7 +152,7 @@ struct Permutation {
                                [b.corners[i].orientation];
         }
         // edges
-        for (unsigned short int i = UF; i <= RF; i++) {
+        for (int i = UF; i <= RF; i++) {
             // calc replaced by
             res.edges[i].replaced_by =
                 a.edges[b.edges[i].replaced_by].replaced_by;
@@ -82,6 +163,29 @@ struct Permutation {
         }
         return res;
     }
+    // whether a * b == b * a. Checked cubie by cubie, corners first, so that
+    // it usually stops at the first corner instead of building both products
+    static bool commutes(const Permutation& a, const Permutation& b) {
+        for (int i = 0; i < CornerCubieLength; i++) {
+            CubiePermutation ab = a.corners[b.corners[i].replaced_by];
+            CubiePermutation ba = b.corners[a.corners[i].replaced_by];
+            if (ab.replaced_by != ba.replaced_by ||
+                orientation_sum[ab.orientation][b.corners[i].orientation] !=
+                    orientation_sum[ba.orientation][a.corners[i].orientation]) {
+                return false;
+            }
+        }
+        for (int i = 0; i < EdgeCubieLength; i++) {
+            CubiePermutation ab = a.edges[b.edges[i].replaced_by];
+            CubiePermutation ba = b.edges[a.edges[i].replaced_by];
+            if (ab.replaced_by != ba.replaced_by ||
+                (ab.orientation ^ b.edges[i].orientation) !=
+                    (ba.orientation ^ a.edges[i].orientation)) {
+                return false;
+            }
+        }
+        return true;
+    }
     static Permutation mult_vector(const vector<Permutation> perms) {
         Permutation res = perms[0];
         for (int i = 1; i < perms.size(); i++) {
@@ -98,16 +202,31 @@ struct Permutation {
             return Permutation::mult(p, Permutation::power(p, times - 1));
         }
     }
-    static bool equals(const Permutation a, const Permutation b) {
+    static bool equals(const Permutation& a, const Permutation& b) {
+#ifdef __SSSE3__
+        __m128i same = _mm_and_si128(
+            _mm_and_si128(
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)a.corners),
+                               _mm_loadu_si128((const __m128i*)b.corners)),
+                _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)a.edges),
+                               _mm_loadu_si128((const __m128i*)b.edges))),
+            _mm_cmpeq_epi8(_mm_loadl_epi64((const __m128i*)(a.edges + 8)),
+                           _mm_loadl_epi64((const __m128i*)(b.edges + 8))));
+        return _mm_movemask_epi8(same) == 0xFFFF;
+#else
+        return equals_scalar(a, b);
+#endif
+    }
+    static bool equals_scalar(const Permutation& a, const Permutation& b) {
         // corners
-        for (unsigned short int i = URF; i <= DLB; i++) {
+        for (int i = URF; i <= DLB; i++) {
             if (a.corners[i].orientation != b.corners[i].orientation ||
                 a.corners[i].replaced_by != b.corners[i].replaced_by) {
                 return false;
             }
         }
         // edges
-        for (unsigned short int i = UF; i <= RF; i++) {
+        for (int i = UF; i <= RF; i++) {
             if (a.edges[i].orientation != b.edges[i].orientation ||
                 a.edges[i].replaced_by != b.edges[i].replaced_by) {
                 return false;
@@ -115,6 +234,22 @@ struct Permutation {
         }
         return true;
     }
+    static Permutation inverse(const Permutation& p) {
+        Permutation res;
+        for (int i = 0; i < CornerCubieLength; i++) {
+            res.corners[p.corners[i].replaced_by].replaced_by = i;
+            // G and G2 are inverses, reflections are their own inverses
+            unsigned char o = p.corners[i].orientation;
+            res.corners[p.corners[i].replaced_by].orientation =
+                o == G ? (unsigned char)G2 : o == G2 ? (unsigned char)G : o;
+        }
+        for (int i = 0; i < EdgeCubieLength; i++) {
+            res.edges[p.edges[i].replaced_by].replaced_by = i;
+            res.edges[p.edges[i].replaced_by].orientation =
+                p.edges[i].orientation;
+        }
+        return res;
+    }
     static Permutation identity() {
         Permutation res;
         for (int i = 0; i < CornerCubieLength; i++) {
@@ -132,13 +267,13 @@ struct Permutation {
         for (int i = 0; i < CornerCubieLength; i++) {
             cout << CornerCubieName[i] << "->"
                  << CornerCubieName[p.corners[i].replaced_by] << "("
-                 << p.corners[i].orientation << ")" << endl;
+                 << (int)p.corners[i].orientation << ")" << endl;
         }
         cout << "edges: " << endl;
         for (int i = 0; i < EdgeCubieLength; i++) {
             cout << EdgeCubieName[i] << "->"
                  << EdgeCubieName[p.edges[i].replaced_by] << "("
-                 << p.edges[i].orientation << ")" << endl;
+                 << (int)p.edges[i].orientation << ")" << endl;
         }
     }
     inline static bool edge_permutation_is_even(Permutation& p) {
@@ -162,6 +297,55 @@ struct Permutation {
         }
         return (parity & 1) == 0;
     }
+    inline static bool corner_permutation_is_even(Permutation& p) {
+        bool already_seen[8]{false};
+        int replaced_by;
+        int cycle_length;
+        int parity = 0;
+        for (int i = 0; i < 8; i++) {
+            if (already_seen[i]) {
+                continue;
+            }
+            cycle_length = 1;
+            already_seen[i] = true;
+            replaced_by = p.corners[i].replaced_by;
+            while (!already_seen[replaced_by]) {
+                cycle_length++;
+                already_seen[replaced_by] = true;
+                replaced_by = p.corners[replaced_by].replaced_by;
+            }
+            parity ^= (~cycle_length) & 1;
+        }
+        return (parity & 1) == 0;
+    }
+    // true iff p can be reached from the identity by face moves (which
+    // excludes reflections, twisted corners, flipped edges and swaps)
+    static bool is_solvable(Permutation& p) {
+        bool corner_seen[8]{false};
+        bool edge_seen[12]{false};
+        int corner_twist = 0;
+        int edge_flip = 0;
+        for (int i = 0; i < CornerCubieLength; i++) {
+            if (p.corners[i].replaced_by >= CornerCubieLength ||
+                p.corners[i].orientation > G2 ||
+                corner_seen[p.corners[i].replaced_by]) {
+                return false;
+            }
+            corner_seen[p.corners[i].replaced_by] = true;
+            corner_twist += p.corners[i].orientation;
+        }
+        for (int i = 0; i < EdgeCubieLength; i++) {
+            if (p.edges[i].replaced_by >= EdgeCubieLength ||
+                p.edges[i].orientation > 1 ||
+                edge_seen[p.edges[i].replaced_by]) {
+                return false;
+            }
+            edge_seen[p.edges[i].replaced_by] = true;
+            edge_flip += p.edges[i].orientation;
+        }
+        return corner_twist % 3 == 0 && edge_flip % 2 == 0 &&
+               corner_permutation_is_even(p) == edge_permutation_is_even(p);
+    }
 };
 
 enum CanonicalPermutationIndex {
@@ -190,6 +374,33 @@ string CanonicalPermutationName[] = {"U",  "R",  "F",  "D",  "L",  "B",
                                      "U2", "R2", "F2", "D2", "L2", "B2",
                                      "Ui", "Ri", "Fi", "Di", "Li", "Bi"};
 
+// CanonicalPermutationName[m] followed by a space
+const char _move_name_text[][4] = {"U ",  "R ",  "F ",  "D ",  "L ",  "B ",
+                                   "U2 ", "R2 ", "F2 ", "D2 ", "L2 ", "B2 ",
+                                   "Ui ", "Ri ", "Fi ", "Di ", "Li ", "Bi "};
+
+// writes "U R2 Fi " for `count` CanonicalPermutation indexes to `out`, and
+// returns how many chars it wrote (no \0 among them), 3 * count at most. -1
+// if they do not fit in `capacity` chars, in which case `out` holds only the
+// names which fit
+inline int FormatMoveNames(const unsigned char* moves,
+                           int count,
+                           char* out,
+                           int capacity) {
+    int offset = 0;
+    for (int i = 0; i < count; i++) {
+        int length = moves[i] < 6 ? 2 : 3;
+        if (offset + length > capacity) {
+            return -1;
+        }
+        // whole words are faster to copy, when there is room
+        memcpy(out + offset, _move_name_text[moves[i]],
+               offset + 4 <= capacity ? 4 : length);
+        offset += length;
+    }
+    return offset;
+}
+
 // Ui, Ri, Fi, Di, Li, Bi
 const Permutation _FacePermutationInverse[6] = {
     {
@@ -1,8 +1,16 @@
 #ifndef __PRUNINGTABLE__
 #define __PRUNINGTABLE__
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
 #include <chrono>
 #include <fstream>
 #include <queue>
+#include <thread>
+#include <vector>
 #include "coordinate.cpp"
 #include "movetable.cpp"
 
@@ -31,20 +39,42 @@ const int MapEntryDecMod3[3] = {2, 3, 1};
 
 enum Entry { Empty, PlusOneMod3, MinusOneMod3, ZeroMod3 };
 
+// positions PruningTable::get_real_batch walks at once: the three axes of a
+// cube
+const int RealDepthBatchSize = 3;
+
+// neighbours each walk of PruningTable::get_real_batch tries at once. Divides
+// CanonicalPermutationLength
+const int RealDepthChunk = 6;
+
+// 2 bits per entry, so 4 entries per byte
+const int PruningTableRowSize = EdgeOrientationCoordinateLength >> 2;
+
+// The table is a single block, indexed by [ud slice sorted class][corner
+// orientation][edge orientation], which is also the layout of the file. A
+// table loaded from a file maps it read-only: processes using the same file
+// share its pages in the page cache, and nothing is copied at startup.
 struct PruningTable {
-    char*** _table;
+    char* _table = nullptr;
+    /* bytes mapped at _table */
+    size_t _size = 0;
 
-    ~PruningTable() {
-        if (_table == nullptr) {
-            return;
-        }
-        for (int i = 0; i < UDSliceSortedClassCount; i++) {
-            for (int j = 0; j < CornerOrientationCoordinateLength; j++) {
-                delete[] _table[i][j];
-            }
-            delete[] _table[i];
-        }
-        delete[] _table;
+    ~PruningTable() { deallocate(); }
+
+    static size_t size() {
+        return (size_t)UDSliceSortedClassCount *
+               CornerOrientationCoordinateLength * PruningTableRowSize;
+    }
+
+    // offset of the byte holding the entry
+    static inline size_t offset(int ud_slice_sorted_class_index,
+                                int edge_orientation_coord,
+                                int corner_orientation_coord) {
+        return ((size_t)ud_slice_sorted_class_index *
+                    CornerOrientationCoordinateLength +
+                corner_orientation_coord) *
+                   PruningTableRowSize +
+               (edge_orientation_coord >> 2);
     }
 
     // Beware: *ud_slice_sorted_coord becomes a class index, not a full coord
@@ -56,8 +86,9 @@ struct PruningTable {
             *ud_slice_sorted_coord)];
         *ud_slice_sorted_coord = ud_class;
         *edge_orientation_coord =
-            EdgeOrientationConjugate[*edge_orientation_coord][ud_class]
-                                    [inv_symmetry];
+            EdgeOrientationConjugate[*edge_orientation_coord *
+                                         UDSliceSortedClassCount +
+                                     ud_class][inv_symmetry];
         *corner_orientation_coord =
             CornerOrientationConjugate[*corner_orientation_coord][inv_symmetry];
     }
@@ -66,10 +97,10 @@ struct PruningTable {
     inline int get(int ud_slice_sorted_class_index,
                    int edge_orientation_coord,
                    int corner_orientation_coord) const {
-        const int outer = edge_orientation_coord >> 2;
         const int inner = edge_orientation_coord & 3;
-        return (_table[ud_slice_sorted_class_index][corner_orientation_coord]
-                      [outer] >>
+        return (_table[offset(ud_slice_sorted_class_index,
+                              edge_orientation_coord,
+                              corner_orientation_coord)] >>
                 (inner << 1)) &
                3;
     }
@@ -85,6 +116,19 @@ struct PruningTable {
                    corner_orientation_coord);
     }
 
+    // the byte holding the entry get_simpl reads, and in *shift where the
+    // entry is in it. Lets the caller prefetch the entry before reading it
+    inline const char* locate(int ud_slice_sorted_coord,
+                              int edge_orientation_coord,
+                              int corner_orientation_coord,
+                              int* shift) const {
+        reduce_to_representant(&ud_slice_sorted_coord, &edge_orientation_coord,
+                               &corner_orientation_coord);
+        *shift = (edge_orientation_coord & 3) << 1;
+        return &_table[offset(ud_slice_sorted_coord, edge_orientation_coord,
+                              corner_orientation_coord)];
+    }
+
     // result is the real lower-bound-depth (not mod 3)
     inline int get_real(int ud_slice_sorted_class_index,
                         int edge_orientation_coord,
@@ -126,42 +170,163 @@ struct PruningTable {
                         corner_orientation_coord);
     }
 
+    // get_real_simpl of `count` positions at once, at most
+    // RealDepthBatchSize. get_real reads the entries of the neighbours of a
+    // position one after the other until one is a step closer to depth 0,
+    // each read most likely a cache miss. Here the walks go in lockstep, and
+    // the next RealDepthChunk neighbours of every walk are located and
+    // prefetched before any of them is read, so that their misses overlap
+    void get_real_batch(int count,
+                        const int* ud_slice_sorted_coords,
+                        const int* edge_orientation_coords,
+                        const int* corner_orientation_coords,
+                        int* depths) const {
+        int ud[RealDepthBatchSize];
+        int edge[RealDepthBatchSize];
+        int corner[RealDepthBatchSize];
+        int depthMod3[RealDepthBatchSize];
+        /* the first neighbour not tried yet, -1 once at depth 0 */
+        int next_move[RealDepthBatchSize];
+        /* the neighbours being tried, and where their entries are */
+        int next_ud[RealDepthBatchSize][RealDepthChunk];
+        int next_edge[RealDepthBatchSize][RealDepthChunk];
+        int next_corner[RealDepthBatchSize][RealDepthChunk];
+        const char* entries[RealDepthBatchSize][RealDepthChunk];
+        int walking_count = 0;
+        for (int w = 0; w < count; w++) {
+            ud[w] = ud_slice_sorted_coords[w];
+            edge[w] = edge_orientation_coords[w];
+            corner[w] = corner_orientation_coords[w];
+            reduce_to_representant(&ud[w], &edge[w], &corner[w]);
+            depthMod3[w] = get(ud[w], edge[w], corner[w]);
+            depthMod3[w] = depthMod3[w] == 3 ? 0 : depthMod3[w];
+            depths[w] = 0;
+            next_move[w] = ud[w] != 0 || edge[w] != 0 || corner[w] != 0 ? 0
+                                                                        : -1;
+            walking_count += next_move[w] == 0 ? 1 : 0;
+        }
+        while (walking_count > 0) {
+            for (int w = 0; w < count; w++) {
+                for (int k = 0; k < RealDepthChunk && next_move[w] >= 0; k++) {
+                    int m = next_move[w] + k;
+                    next_ud[w][k] = SymUDSliceSortedRepresentantMove[ud[w]][m];
+                    next_edge[w][k] = EdgeOrientationMove[edge[w]][m];
+                    next_corner[w][k] = CornerOrientationMove[corner[w]][m];
+                    reduce_to_representant(&next_ud[w][k], &next_edge[w][k],
+                                           &next_corner[w][k]);
+                    entries[w][k] = &_table[offset(
+                        next_ud[w][k], next_edge[w][k], next_corner[w][k])];
+                    __builtin_prefetch(entries[w][k]);
+                }
+            }
+            for (int w = 0; w < count; w++) {
+                if (next_move[w] < 0) {
+                    continue;
+                }
+                int k = 0;
+                while (k < RealDepthChunk &&
+                       ((*entries[w][k] >> ((next_edge[w][k] & 3) << 1)) &
+                        3) != MapEntryDecMod3[depthMod3[w]]) {
+                    k++;
+                }
+                if (k == RealDepthChunk) {
+                    // some neighbour is a step closer, in a later chunk
+                    next_move[w] = (next_move[w] + RealDepthChunk) %
+                                   CanonicalPermutationLength;
+                    continue;
+                }
+                ud[w] = next_ud[w][k];
+                edge[w] = next_edge[w][k];
+                corner[w] = next_corner[w][k];
+                depths[w]++;
+                depthMod3[w] = DecMod3[depthMod3[w]];
+                next_move[w] = 0;
+                if (ud[w] == 0 && edge[w] == 0 && corner[w] == 0) {
+                    next_move[w] = -1;
+                    walking_count--;
+                }
+            }
+        }
+    }
+
+    // same as get_real_simpl(...) > bound, but walks at most `bound` steps
+    // towards depth 0 instead of all of them
+    inline bool exceeds(int ud_slice_sorted_coord,
+                        int edge_orientation_coord,
+                        int corner_orientation_coord,
+                        int bound) const {
+        int depthMod3, temp_edge, temp_corner, temp_sym_coord;
+        reduce_to_representant(&ud_slice_sorted_coord, &edge_orientation_coord,
+                               &corner_orientation_coord);
+        depthMod3 = get(ud_slice_sorted_coord, edge_orientation_coord,
+                        corner_orientation_coord);
+        depthMod3 = depthMod3 == 3 ? 0 : depthMod3;
+        for (int steps = 0; ud_slice_sorted_coord != 0 ||
+                            edge_orientation_coord != 0 ||
+                            corner_orientation_coord != 0;
+             steps++) {
+            if (steps == bound) {
+                return true;
+            }
+            for (int m = 0; m < CanonicalPermutationLength; m++) {
+                temp_sym_coord =
+                    SymUDSliceSortedRepresentantMove[ud_slice_sorted_coord][m];
+                temp_edge = EdgeOrientationMove[edge_orientation_coord][m];
+                temp_corner =
+                    CornerOrientationMove[corner_orientation_coord][m];
+                reduce_to_representant(&temp_sym_coord, &temp_edge,
+                                       &temp_corner);
+                if (get(temp_sym_coord, temp_edge, temp_corner) ==
+                    MapEntryDecMod3[depthMod3]) {
+                    ud_slice_sorted_coord = temp_sym_coord;
+                    edge_orientation_coord = temp_edge;
+                    corner_orientation_coord = temp_corner;
+                    depthMod3 = DecMod3[depthMod3];
+                    break;
+                }
+            }
+        }
+        return false;
+    }
+
     // only works once. value must be one of {0, 1, 2, 3}
     inline void set(int ud_slice_sorted_class_index,
                     int edge_orientation_coord,
                     int corner_orientation_coord,
                     int value) {
-        const int outer = edge_orientation_coord >> 2;
         const int inner = edge_orientation_coord & 3;
-        _table[ud_slice_sorted_class_index][corner_orientation_coord][outer] |=
-            (value << (inner << 1));
+        _table[offset(ud_slice_sorted_class_index, edge_orientation_coord,
+                      corner_orientation_coord)] |= (value << (inner << 1));
     }
 
+    // an empty, writable table, to be built
     void allocate() {
+        deallocate();
         cout << "started allocating" << endl;
-        // 2 bits (1/4 of an int) per effective entry
-        _table = new char**[UDSliceSortedClassCount];
-        for (int i = 0; i < UDSliceSortedClassCount; i++) {
-            _table[i] = new char*[CornerOrientationCoordinateLength];
-            for (int j = 0; j < CornerOrientationCoordinateLength; j++) {
-                _table[i][j] = new char[EdgeOrientationCoordinateLength >> 2]{
-                    0};  // divide by four (four entries per byte)
-            }
+        // anonymous pages are zeroed (i.e. Empty) lazily, by the kernel
+        void* table = mmap(nullptr, size(), PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (table == MAP_FAILED) {
+            cerr << "could not allocate the pruning table" << endl;
+            exit(1);
         }
+        _table = (char*)table;
+        _size = size();
         cout << "finished allocating" << endl;
     }
 
     void deallocate() {
-        for (int i = 0; i < UDSliceSortedClassCount; i++) {
-            for (int j = 0; j < CornerOrientationCoordinateLength; j++) {
-                delete[] _table[i][j];
-            }
-            delete[] _table[i];
+        if (_table != nullptr) {
+            munmap(_table, _size);
+            _table = nullptr;
+            _size = 0;
         }
-        delete[] _table;
     }
 
-    void build() {
+    // Breadth-first search from the solved cube, on one thread. Stops after
+    // max_depth, which is only useful to compare with build_parallel. If
+    // given, count_per_depth_out[d] receives the number of entries of depth d
+    void build(uint64_t* count_per_depth_out = nullptr, int max_depth = 20) {
         const auto start_time = chrono::system_clock().now();
         const unsigned int all = UDSliceSortedClassCount *
                                  CornerOrientationCoordinateLength *
@@ -172,7 +337,7 @@ struct PruningTable {
         int equiv_sym_ud, equiv_corner, equiv_edge, equiv_ud_class,
             equiv_symmetry;
         Vector* equivalent_list;
-        int count_per_depth[21]{0};
+        uint64_t count_per_depth[21]{0};
 
         // Process first entry (and its equivalents)
         equivalent_list =
@@ -186,8 +351,9 @@ struct PruningTable {
                 [current.corner_orientation_coord]
                 [InverseSymmetryIndex[equiv_symmetry]];
             equiv_edge =
-                EdgeOrientationConjugate[current.edge_orientation_coord]
-                                        [equiv_ud_class]
+                EdgeOrientationConjugate[current.edge_orientation_coord *
+                                             UDSliceSortedClassCount +
+                                         equiv_ud_class]
                                         [InverseSymmetryIndex[equiv_symmetry]];
             if (get(equiv_ud_class, equiv_edge, equiv_corner) == Empty) {
                 set(equiv_ud_class, equiv_edge, equiv_corner,
@@ -199,7 +365,7 @@ struct PruningTable {
 
         int real_current_depth = 0, real_next_depth, current_depth = 0,
             map_entry_current_depth, map_entry_next_depth, equiv_size;
-        while (visited_count < all) {
+        while (visited_count < all && real_current_depth < max_depth) {
             map_entry_current_depth = MapEntry[current_depth];
             next_depth = IncMod3[current_depth];
             map_entry_next_depth = MapEntry[next_depth];
@@ -239,7 +405,8 @@ struct PruningTable {
                                     [next_corner]
                                     [InverseSymmetryIndex[equiv_symmetry]];
                                 equiv_edge = EdgeOrientationConjugate
-                                    [next_edge][equiv_ud_class]
+                                    [next_edge * UDSliceSortedClassCount +
+                                     equiv_ud_class]
                                     [InverseSymmetryIndex[equiv_symmetry]];
                                 if (get(equiv_ud_class, equiv_edge,
                                         equiv_corner) == Empty) {
@@ -256,31 +423,206 @@ struct PruningTable {
             current_depth = next_depth;
             real_current_depth = real_next_depth;
         }
+        if (count_per_depth_out != nullptr) {
+            for (int d = 0; d < 21; d++) {
+                count_per_depth_out[d] = count_per_depth[d];
+            }
+        }
         cout << (chrono::system_clock().now().time_since_epoch() -
                  start_time.time_since_epoch())
                     .count()
              << endl;
     }
 
-    void save_to_file(string filename) {
-        ofstream output(filename);
-        for (int i = 0; i < UDSliceSortedClassCount; i++) {
-            for (int j = 0; j < CornerOrientationCoordinateLength; j++) {
-                output.write(_table[i][j],
-                             EdgeOrientationCoordinateLength >> 2);
+    // sets the entry to `value` unless it has one already. Threads may set
+    // entries of the same byte at once. true iff the entry was Empty
+    inline bool set_if_empty(int ud_slice_sorted_class_index,
+                             int edge_orientation_coord,
+                             int corner_orientation_coord,
+                             int value) {
+        char* byte = &_table[offset(ud_slice_sorted_class_index,
+                                    edge_orientation_coord,
+                                    corner_orientation_coord)];
+        const int shift = (edge_orientation_coord & 3) << 1;
+        char old_byte = __atomic_load_n(byte, __ATOMIC_RELAXED);
+        while (((old_byte >> shift) & 3) == Empty) {
+            if (__atomic_compare_exchange_n(byte, &old_byte,
+                                            (char)(old_byte | (value << shift)),
+                                            true, __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+                return true;
             }
         }
-        output.close();
+        return false;
+    }
+
+    // sets the Empty entries among the neighbours of an entry and their
+    // equivalents to `value`. Returns how many there were
+    inline int expand(int ud_slice_sorted_class_index,
+                      int edge_orientation_coord,
+                      int corner_orientation_coord,
+                      int value) {
+        int added = 0;
+        for (int m = 0; m < CanonicalPermutationLength; m++) {
+            const int next_sym_ud =
+                SymUDSliceSortedRepresentantMove[ud_slice_sorted_class_index]
+                                                [m];
+            const int next_corner =
+                CornerOrientationMove[corner_orientation_coord][m];
+            const int next_edge =
+                EdgeOrientationMove[edge_orientation_coord][m];
+            // class is the same for all equivalents
+            const int next_class = SymUDSliceSortedClass(next_sym_ud);
+            Vector* equivalent_list =
+                &UDSliceSortedRaw2Sym[UDSliceSortedSym2Raw[next_sym_ud]];
+            const int equiv_size = equivalent_list->size();
+            for (int eq = 0; eq < equiv_size; eq++) {
+                const int inverse_symmetry =
+                    InverseSymmetryIndex[SymUDSliceSortedSymmetry(
+                        (*equivalent_list)[eq])];
+                added += set_if_empty(
+                    next_class,
+                    EdgeOrientationConjugate[next_edge *
+                                                 UDSliceSortedClassCount +
+                                             next_class][inverse_symmetry],
+                    CornerOrientationConjugate[next_corner][inverse_symmetry],
+                    value);
+            }
+        }
+        return added;
     }
 
-    void load_from_file(string filename) {
-        ifstream input(filename);
-        for (int i = 0; i < UDSliceSortedClassCount; i++) {
-            for (int j = 0; j < CornerOrientationCoordinateLength; j++) {
-                input.read(_table[i][j], EdgeOrientationCoordinateLength >> 2);
+    // expands every entry equal to `current_entry`, class by class, taking
+    // the classes from `next_class` until there are none left. Returns how
+    // many entries were set
+    uint64_t expand_classes(std::atomic<int>* next_class,
+                            int current_entry,
+                            int next_entry) {
+        uint64_t added = 0;
+        int ud_class;
+        while ((ud_class = next_class->fetch_add(1)) <
+               UDSliceSortedClassCount) {
+            for (int corner = 0; corner < CornerOrientationCoordinateLength;
+                 corner++) {
+                const char* row = &_table[offset(ud_class, 0, corner)];
+                for (int b = 0; b < PruningTableRowSize; b++) {
+                    // other threads only turn Empty entries into next_entry
+                    const char byte =
+                        __atomic_load_n(&row[b], __ATOMIC_RELAXED);
+                    if (byte == 0) {
+                        continue;
+                    }
+                    for (int inner = 0; inner < 4; inner++) {
+                        if (((byte >> (inner << 1)) & 3) == current_entry) {
+                            added += expand(ud_class, (b << 2) | inner, corner,
+                                            next_entry);
+                        }
+                    }
+                }
             }
         }
-        input.close();
+        return added;
+    }
+
+    // Same table and counts as build, but the entries of each depth are
+    // expanded by `thread_count` threads, which share out the classes
+    void build_parallel(int thread_count,
+                        uint64_t* count_per_depth_out = nullptr,
+                        int max_depth = 20) {
+        const auto start_time = chrono::steady_clock::now();
+        const uint64_t all = (uint64_t)UDSliceSortedClassCount *
+                             CornerOrientationCoordinateLength *
+                             EdgeOrientationCoordinateLength;
+        uint64_t count_per_depth[21]{0};
+
+        // the solved cube and its equivalents
+        Vector* equivalent_list =
+            &UDSliceSortedRaw2Sym[UDSliceSortedSym2Raw[0]];
+        for (int eq = 0; eq < equivalent_list->size(); eq++) {
+            const int equiv_sym_ud = (*equivalent_list)[eq];
+            const int equiv_class = SymUDSliceSortedClass(equiv_sym_ud);
+            const int inverse_symmetry =
+                InverseSymmetryIndex[SymUDSliceSortedSymmetry(equiv_sym_ud)];
+            // edge orientation 0, whose rows come first
+            count_per_depth[0] += set_if_empty(
+                equiv_class,
+                EdgeOrientationConjugate[equiv_class][inverse_symmetry],
+                CornerOrientationConjugate[0][inverse_symmetry], MapEntry[0]);
+        }
+
+        uint64_t visited_count = count_per_depth[0];
+        for (int depth = 0; visited_count < all && depth < max_depth;
+             depth++) {
+            cout << "count_per_depth[" << depth
+                 << "] == " << count_per_depth[depth] << endl;
+            std::atomic<int> next_class{0};
+            std::atomic<uint64_t> added{0};
+            auto expand_depth = [&]() {
+                added += expand_classes(&next_class, MapEntry[depth % 3],
+                                        MapEntry[(depth + 1) % 3]);
+            };
+            vector<std::thread> helpers;
+            for (int t = 1; t < thread_count; t++) {
+                helpers.push_back(std::thread(expand_depth));
+            }
+            expand_depth();
+            for (auto& helper : helpers) {
+                helper.join();
+            }
+            count_per_depth[depth + 1] = added;
+            visited_count += added;
+        }
+        if (count_per_depth_out != nullptr) {
+            for (int d = 0; d < 21; d++) {
+                count_per_depth_out[d] = count_per_depth[d];
+            }
+        }
+        cout << "built in "
+             << chrono::duration<double>(chrono::steady_clock::now() -
+                                         start_time)
+                    .count()
+             << "s" << endl;
+    }
+
+    // writes a new file and renames it over `filename`: servers which mapped
+    // the old one keep it intact
+    void save_to_file(string filename) {
+        string temporary = filename + ".tmp";
+        ofstream output(temporary);
+        output.write(_table, size());
+        output.close();
+        rename(temporary.c_str(), filename.c_str());
+    }
+
+    // Maps the file read-only, replacing the current table. With `populate`,
+    // every page is read in now (MAP_POPULATE) rather than on first use.
+    // false if the file cannot be mapped or is too short
+    bool load_from_file(string filename, bool populate = false) {
+        deallocate();
+        int fd = open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) < 0) {
+            close(fd);
+            return false;
+        }
+        if ((size_t)file_stat.st_size < size()) {
+            close(fd);
+            errno = EINVAL;
+            return false;
+        }
+        void* table = mmap(nullptr, size(), PROT_READ,
+                           MAP_SHARED | (populate ? MAP_POPULATE : 0), fd, 0);
+        // the mapping outlives the descriptor
+        close(fd);
+        if (table == MAP_FAILED) {
+            return false;
+        }
+        _table = (char*)table;
+        _size = size();
+        return true;
     }
 };
 
@@ -1,6 +1,8 @@
 #ifndef __SOLVE__
 #define __SOLVE__
 
+#include <time.h>
+#include <atomic>
 #include <string>
 #include <vector>
 #include "permutation.cpp"
@@ -27,20 +29,127 @@ struct CubeState {
     int lr_pruning;
     /* symmetry-discarding auxiliary */
     uint64_t equal_by_sequence;
+    /* the inverse cube, only kept when using the inverse heuristic */
+    Permutation inverse;
 };
 
+// -DSOLVE_STATS makes CubeSolver fill CubeSolution::stats. Without it the
+// counting code is compiled out, and SolveStats is empty
+#ifdef SOLVE_STATS
+const bool SolveStatsEnabled = true;
+#else
+const bool SolveStatsEnabled = false;
+#endif
+
+// IDA* iterations told apart by SolveStats. The last one also counts the
+// deeper ones
+const int SolveStatsDepths = 21;
+
+#ifdef SOLVE_STATS
+// What a search did, to tell why it took long
+struct SolveStats {
+    /* per IDA* iteration, indexed by its boundary depth (the iteration
+       looking for solutions of d + 1 moves): nodes reached by a move, nodes
+       the search went on from, and nanoseconds spent. The times of parallel
+       searches add up those of every thread */
+    uint64_t generated[SolveStatsDepths] = {};
+    uint64_t expanded[SolveStatsDepths] = {};
+    uint64_t iteration_ns[SolveStatsDepths] = {};
+    /* nodes cut by their pruning values, along with the rest of their axis */
+    uint64_t pruned_axis = 0;
+    /* nodes cut by their pruning values alone */
+    uint64_t pruned_exponent = 0;
+    /* moves not tried because a symmetric one is */
+    uint64_t pruned_symmetry = 0;
+    /* axes not tried after a move of the same or of the opposite axis */
+    uint64_t pruned_neighbour_axis = 0;
+    /* nodes cut by the pruning values of their inverse (use_inverse) */
+    uint64_t pruned_inverse = 0;
+    /* pruning table entries looked up for generated nodes, not counting
+       those read walking down to depth 0 */
+    uint64_t table_lookups = 0;
+    /* nanoseconds spent in CubeSolver::reinitialize */
+    uint64_t setup_ns = 0;
+
+    void add(const SolveStats& other) {
+        for (int d = 0; d < SolveStatsDepths; d++) {
+            generated[d] += other.generated[d];
+            expanded[d] += other.expanded[d];
+            iteration_ns[d] += other.iteration_ns[d];
+        }
+        pruned_axis += other.pruned_axis;
+        pruned_exponent += other.pruned_exponent;
+        pruned_symmetry += other.pruned_symmetry;
+        pruned_neighbour_axis += other.pruned_neighbour_axis;
+        pruned_inverse += other.pruned_inverse;
+        table_lookups += other.table_lookups;
+        setup_ns += other.setup_ns;
+    }
+};
+#else
+// nothing to copy along with each CubeSolution
+struct SolveStats {
+    void add(const SolveStats&) {}
+};
+#endif
+
+// Exhausted: no solution has CubeSolver::max_length moves or fewer (for
+// TwoPhaseSolver, none was found within SolutionMaxLength moves)
+enum SolveStatus { Solved, TimedOut, Cancelled, Exhausted };
+
+// no solver returns longer solutions (two-phase ones are the longest)
+const int SolutionMaxLength = 30;
+
+// Holds the moves as CanonicalPermutation indexes, so returning a solution
+// allocates nothing: their Permutations and names are only built when asked
+// for
 struct CubeSolution {
-    vector<Permutation> moves;
-    vector<int> move_indexes;
-    string move_names;
-    CubeSolution(int length)
-        : moves(vector<Permutation>{}),
-          move_indexes(vector<int>{}),
-          length(length),
-          move_names{""} {}
+    unsigned char move_indexes[SolutionMaxLength];
+    CubeSolution(int length) : length(length) {}
     int length;
+    /* when not Solved, there are no moves */
+    SolveStatus status = Solved;
+    /* when not Solved, or not optimal, no solution has this many moves or
+       fewer */
+    int searched_depth = 0;
+    /* nodes expanded by the search */
+    uint64_t nodes = 0;
+    /* when Solved, whether no solution is shorter */
+    bool optimal = true;
+    /* empty unless built with SOLVE_STATS */
+    SolveStats stats;
+
+    Permutation move(int i) const {
+        return CanonicalPermutation[move_indexes[i]];
+    }
+    // "U R2 Fi "
+    string move_names() const {
+        char names[3 * SolutionMaxLength];
+        return string(names, FormatMoveNames(move_indexes, length, names,
+                                             sizeof(names)));
+    }
 };
 
+// CLOCK_MONOTONIC, in nanoseconds
+inline uint64_t SolveClock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// when to give up on a search. The solver checks them every
+// SolveCheckInterval nodes, so it stops a few microseconds late at most
+struct SolveLimits {
+    /* a SolveClock() time, 0 for none */
+    uint64_t deadline = 0;
+    /* set by another thread to stop the search, nullptr for none */
+    const std::atomic<bool>* cancelled = nullptr;
+    /* set when another thread of a parallel search found a solution */
+    const std::atomic<bool>* finished = nullptr;
+};
+
+const int SolveCheckInterval = 1 << 14;
+
 int** _build_axis_exponent_2_move() {
     int** res = new int*[6];
     for (int axis = 0; axis < 6; axis++) {
@@ -114,6 +223,8 @@ uint64_t* GreaterBy = _build_greater_by();
 
 enum ShouldIncrease { Axis, Exponent, Nothing };
 
+enum SearchStep { Pending, Found, Stopped };
+
 struct ExpectedToIncreaseSomething {};
 
 const int fb_transform = FullSymmetryIndex(SymmetryS_R4i);
@@ -123,6 +234,11 @@ const int lr_transform = FullSymmetryIndex(
 
 struct DidNotSolveWithin20Moves {};
 
+// the canonical move undoing `move`
+inline int InverseMove(int move) {
+    return move % 6 + 6 * (2 - move / 6);
+}
+
 struct CubeSolver {
     CubeState states[30];
     CubeState* current = &states[0];
@@ -130,18 +246,45 @@ struct CubeSolver {
     int remaining_depth = 0;
     PruningTable* table;
     uint64_t original_symmetries;
+    SolveLimits limits;
+    int nodes_until_check = SolveCheckInterval;
+    /* nodes expanded up to the last check */
+    uint64_t nodes_checked = 0;
+    SolveStatus status = Solved;
+    /* the search never backtracks below floor. Once every move from it was
+       tried, it looks for longer solutions if deepen, else it gives up */
+    CubeState* floor = &states[0];
+    bool deepen = true;
+    /* state of the search run by step */
+    ShouldIncrease step_should_increase = Exponent;
+    int step_move;
+    bool step_pending = false;
+    const char* pending_entries[3];
+    int pending_shifts[3];
+    /* also prune nodes whose inverse is too far from solved (see
+       inverse_prunes) */
+    bool use_inverse = false;
+    /* gives up once no solution has this many moves or fewer, 0 for never */
+    int max_length = 0;
+    /* since begin, with SOLVE_STATS */
+    SolveStats stats;
+    uint64_t iteration_started_at = 0;
 
     CubeSolver(PruningTable* table) : table(table) {}
 
     inline void reinitialize(Permutation& p) {
+#ifdef SOLVE_STATS
+        uint64_t started_at = SolveClock();
+#endif
         boundary_depth = 0;
         remaining_depth = 0;
         original_symmetries = 0;
 
         current = &states[0];
         current->equal_by_sequence = 0UL;
+        // p equals its conjugate by a symmetry iff they commute
         for (uint64_t i = 0UL; i < FullSymmetryLength; i++) {
-            if (Permutation::equals(p, FullSymmetryConjugate(p, i))) {
+            if (Permutation::commutes(FullSymmetry[i], p)) {
                 current->equal_by_sequence |= (1UL << i);
             }
         }
@@ -150,28 +293,57 @@ struct CubeSolver {
         current->ud_coord = SymUDSliceSortedCoordinate(p);
         // current->ud_class = SymUDSliceSortedClass(current->ud_coord);
         // current->ud_symmetry = SymUDSliceSortedSymmetry(current->ud_coord);
-        current->fb_coord = UDSliceSortedRaw2Sym[FBSliceSortedCoordinate(p)][0];
+        // each conjugate serves its three coordinates
+        Permutation fb = FBConjugate(p);
+        Permutation lr = LRConjugate(p);
+        current->fb_coord = SymUDSliceSortedCoordinate(fb);
         // current->fb_class = SymUDSliceSortedClass(current->fb_coord);
         // current->fb_symmetry = SymUDSliceSortedSymmetry(current->fb_coord);
-        current->lr_coord = UDSliceSortedRaw2Sym[LRSliceSortedCoordinate(p)][0];
+        current->lr_coord = SymUDSliceSortedCoordinate(lr);
         // current->lr_class = SymUDSliceSortedClass(current->lr_coord);
         // current->lr_symmetry = SymUDSliceSortedSymmetry(current->lr_coord);
         current->ud_edge_orientation = EdgeOrientationCoordinate(p);
-        current->fb_edge_orientation = FBEdgeOrientationCoordinate(p);
-        current->lr_edge_orientation = LREdgeOrientationCoordinate(p);
+        current->fb_edge_orientation = EdgeOrientationCoordinate(fb);
+        current->lr_edge_orientation = EdgeOrientationCoordinate(lr);
         current->ud_corner_orientation = CornerOrientationCoordinate(p);
-        current->fb_corner_orientation = FBCornerOrientationCoordinate(p);
-        current->lr_corner_orientation = LRCornerOrientationCoordinate(p);
+        current->fb_corner_orientation = CornerOrientationCoordinate(fb);
+        current->lr_corner_orientation = CornerOrientationCoordinate(lr);
         current->ud_corner_permutation = CornerPermutationCoordinate(p);
-        current->ud_pruning = table->get_real_simpl(
-            current->ud_coord, current->ud_edge_orientation,
-            current->ud_corner_orientation);
-        current->fb_pruning = table->get_real_simpl(
-            current->fb_coord, current->fb_edge_orientation,
-            current->fb_corner_orientation);
-        current->lr_pruning = table->get_real_simpl(
-            current->lr_coord, current->lr_edge_orientation,
-            current->lr_corner_orientation);
+        // the three walks down to depth 0 overlap their memory accesses
+        const int coords[3] = {current->ud_coord, current->fb_coord,
+                               current->lr_coord};
+        const int edges[3] = {current->ud_edge_orientation,
+                              current->fb_edge_orientation,
+                              current->lr_edge_orientation};
+        const int corners[3] = {current->ud_corner_orientation,
+                                current->fb_corner_orientation,
+                                current->lr_corner_orientation};
+        int depths[3];
+        table->get_real_batch(3, coords, edges, corners, depths);
+        current->ud_pruning = depths[0];
+        current->fb_pruning = depths[1];
+        current->lr_pruning = depths[2];
+        if (use_inverse) {
+            current->inverse = Permutation::inverse(p);
+        }
+#ifdef SOLVE_STATS
+        iteration_started_at = SolveClock();
+        stats.setup_ns += iteration_started_at - started_at;
+#endif
+    }
+
+    // the iteration at boundary_depth is over, or stopped
+    inline void record_iteration() {
+#ifdef SOLVE_STATS
+        uint64_t now = SolveClock();
+        stats.iteration_ns[stats_depth()] += now - iteration_started_at;
+        iteration_started_at = now;
+#endif
+    }
+
+    inline int stats_depth() {
+        return boundary_depth < SolveStatsDepths ? boundary_depth
+                                                 : SolveStatsDepths - 1;
     }
 
     // true iff the exponent was not already at maximum (3)
@@ -213,7 +385,8 @@ struct CubeSolver {
                current->axis + 3 == previous->axis;
     }
 
-    inline void execute_move(CubeState* recipient, int move) {
+    // every coordinate of recipient but the pruning values
+    inline void move_coordinates(CubeState* recipient, int move) {
         int fb_move = FullCanonicalPermutationConjugate[move][fb_transform];
         int lr_move = FullCanonicalPermutationConjugate[move][lr_transform];
 
@@ -243,6 +416,10 @@ struct CubeSolver {
 
         recipient->lr_corner_orientation =
             CornerOrientationMove[current->lr_corner_orientation][lr_move];
+    }
+
+    inline void execute_move(CubeState* recipient, int move) {
+        move_coordinates(recipient, move);
 
         recipient->ud_pruning =
             RelativePruning[current->ud_pruning][table->get_simpl(
@@ -260,130 +437,370 @@ struct CubeSolver {
                 recipient->lr_corner_orientation)];
     }
 
-    inline void solution_innerloop(Permutation& p) {
+    // A cube and its inverse need as many moves, so the pruning values of the
+    // inverse bound the search as well, and often better. But moves act on
+    // the inverse from the other side, which the move tables do not cover: it
+    // is kept as a Permutation instead, and its coordinates computed from it.
+    // Its depths cannot be made relative to those of the parent either, so
+    // they are walked down with PruningTable::exceeds, which takes at most
+    // remaining_depth steps: few, in the deep levels where most nodes are.
+    // Only checked for nodes the regular pruning kept, UD first, since the
+    // other axes need conjugating.
+    inline bool inverse_prunes(CubeState* next, int move) {
+        next->inverse = Permutation::mult(
+            CanonicalPermutation[InverseMove(move)], current->inverse);
+        return inverse_exceeds(next->inverse) ||
+               inverse_exceeds(Permutation::mult(
+                   Permutation::mult(FullSymmetry[fb_transform], next->inverse),
+                   FullInverseSymmetry[fb_transform])) ||
+               inverse_exceeds(Permutation::mult(
+                   Permutation::mult(FullSymmetry[lr_transform], next->inverse),
+                   FullInverseSymmetry[lr_transform]));
+    }
+
+    // whether the UD pruning value of `p` is more than remaining_depth
+    inline bool inverse_exceeds(Permutation p) {
+        int ud_coord = UDSliceSortedRaw2Sym[UDSliceSortedCoordinate(p)][0];
+        return table->exceeds(ud_coord, EdgeOrientationCoordinate(p),
+                              CornerOrientationCoordinate(p), remaining_depth);
+    }
+
+    // true iff the search must stop. Sets status accordingly
+    bool limits_reached() {
+        nodes_checked += SolveCheckInterval - nodes_until_check;
+        nodes_until_check = SolveCheckInterval;
+        if ((limits.cancelled != nullptr &&
+             limits.cancelled->load(std::memory_order_relaxed)) ||
+            (limits.finished != nullptr &&
+             limits.finished->load(std::memory_order_relaxed))) {
+            status = Cancelled;
+        } else if (limits.deadline != 0 && SolveClock() >= limits.deadline) {
+            status = TimedOut;
+        }
+        return status != Solved;
+    }
+
+    // true iff a solution was found, false if stopped by the limits
+    inline bool solution_innerloop(Permutation& p) {
         reinitialize(p);
+        floor = &states[0];
+        deepen = true;
+        return search(Exponent);
+    }
+
+    // true iff a solution was found, false if stopped by the limits or, when
+    // not deepening, if every move from floor was tried
+    inline bool search(ShouldIncrease should_increase) {
+        // set by advance before use, which the compiler cannot tell
+        int move = 0;
+        while (advance(should_increase, move)) {
+            CubeState* next = current + 1;
+            execute_move(next, move);
+#ifdef SOLVE_STATS
+            stats.generated[stats_depth()]++;
+            stats.table_lookups += 3;
+#endif
+            if (--nodes_until_check == 0 && limits_reached()) {
+                return false;
+            }
+            should_increase = visit(next, move);
+            if (should_increase == Nothing) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // sets move to the next one to try from current, backtracking or
+    // deepening when every move from current was tried. false once every move
+    // from floor was tried, when not deepening, or once deepening would go
+    // past max_length
+    inline bool advance(ShouldIncrease should_increase, int& move) {
         uint64_t zero = 0UL;
-        int move;
-        CubeState* next;
-        ShouldIncrease should_increase = Exponent, temp_should_increase;
-        while (true) {
-            while (should_increase != ShouldIncrease::Nothing) {
-                temp_should_increase = should_increase;
-                should_increase = ShouldIncrease::Nothing;
-                switch (temp_should_increase) {
-                    case Axis:
-                        if (increase_axis()) {
-                            if (has_discardable_neighbour_axis()) {
-                                should_increase = Axis;
-                                continue;
-                            } else {
-                                current->exponent = 1;
-                            }
-                        } else if (boundary_depth == remaining_depth) {
-                            boundary_depth++;
-                            remaining_depth++;
-                            if (boundary_depth == 20) {
-                                // throw DidNotSolveWithin20Moves();
-                            }
-                            current->axis = U;
-                            current->exponent = 1;
-                        } else {
-                            current--;
-                            remaining_depth++;
-                            should_increase = Exponent;
-                            continue;
-                        }
-                        break;
-                    case Exponent:
-                        if (!increase_exponent()) {
+        ShouldIncrease temp_should_increase;
+        while (should_increase != ShouldIncrease::Nothing) {
+            temp_should_increase = should_increase;
+            should_increase = ShouldIncrease::Nothing;
+            switch (temp_should_increase) {
+                case Axis:
+                    if (increase_axis()) {
+                        if (has_discardable_neighbour_axis()) {
+#ifdef SOLVE_STATS
+                            stats.pruned_neighbour_axis++;
+#endif
                             should_increase = Axis;
                             continue;
+                        } else {
+                            current->exponent = 1;
                         }
-                        break;
-                    default:
-                        // throw ExpectedToIncreaseSomething();
-                        break;
-                }
-                move = AxisExponent2Move[current->axis][current->exponent];
-                // symmetry check
-                if ((current->equal_by_sequence & GreaterBy[move]) != zero) {
-                    should_increase = Exponent;
-                    continue;
-                }
-                next = current + 1;
-                execute_move(next, move);
-                // try to prune
-                if (remaining_depth > 0 &&
-                    next->ud_pruning == next->lr_pruning &&
-                    next->ud_pruning == next->fb_pruning) {
-                    if (next->ud_pruning > remaining_depth) {
-                        should_increase = Axis;
-                        continue;
-                    } else if (next->ud_pruning > remaining_depth - 1) {
+                    } else if (current == floor) {
+                        if (!deepen) {
+                            return false;
+                        }
+                        record_iteration();
+                        boundary_depth++;
+                        remaining_depth++;
+                        if (boundary_depth == max_length) {
+                            status = Exhausted;
+                            return false;
+                        }
+                        if (boundary_depth == 20) {
+                            // throw DidNotSolveWithin20Moves();
+                        }
+                        current->axis = U;
+                        current->exponent = 1;
+                    } else {
+                        current--;
+                        remaining_depth++;
                         should_increase = Exponent;
                         continue;
                     }
-                } else {
-                    if (next->ud_pruning > remaining_depth + 1 ||
-                        next->fb_pruning > remaining_depth + 1 ||
-                        next->lr_pruning > remaining_depth + 1) {
+                    break;
+                case Exponent:
+                    if (!increase_exponent()) {
                         should_increase = Axis;
                         continue;
-                    } else if (next->ud_pruning > remaining_depth ||
-                               next->fb_pruning > remaining_depth ||
-                               next->lr_pruning > remaining_depth) {
-                        should_increase = Exponent;
-                        continue;
                     }
-                }
-            }
-            if (remaining_depth == 0) {
-                if (is_solved(next)) {
                     break;
-                } else {
-                    should_increase = Exponent;
-                    continue;
-                }
-            } else {
-                remaining_depth--;
-                next->equal_by_sequence =
-                    current->equal_by_sequence & EqualBy[move];
-                next->axis = U;
-                next->exponent = 0;
-                current = next;
+                default:
+                    // throw ExpectedToIncreaseSomething();
+                    break;
+            }
+            move = AxisExponent2Move[current->axis][current->exponent];
+            // symmetry check
+            if ((current->equal_by_sequence & GreaterBy[move]) != zero) {
+#ifdef SOLVE_STATS
+                stats.pruned_symmetry++;
+#endif
                 should_increase = Exponent;
-                if (has_discardable_neighbour_axis()) {
-                    next->exponent = 1;
-                    should_increase = Axis;
-                }
-                continue;
             }
         }
+        return true;
+    }
+
+    // called once `next` was reached from current by `move`. Prunes it, or
+    // checks whether it is solved, or makes it current. Returns what to
+    // increase to find the next move, or Nothing if `next` is solved
+    inline ShouldIncrease visit(CubeState* next, int move) {
+        // try to prune
+        if (remaining_depth > 0 && next->ud_pruning == next->lr_pruning &&
+            next->ud_pruning == next->fb_pruning) {
+            if (next->ud_pruning > remaining_depth) {
+                return pruned(Axis);
+            } else if (next->ud_pruning > remaining_depth - 1) {
+                return pruned(Exponent);
+            }
+        } else {
+            if (next->ud_pruning > remaining_depth + 1 ||
+                next->fb_pruning > remaining_depth + 1 ||
+                next->lr_pruning > remaining_depth + 1) {
+                return pruned(Axis);
+            } else if (next->ud_pruning > remaining_depth ||
+                       next->fb_pruning > remaining_depth ||
+                       next->lr_pruning > remaining_depth) {
+                return pruned(Exponent);
+            }
+        }
+        if (remaining_depth == 0) {
+            return is_solved(next) ? Nothing : Exponent;
+        }
+        if (use_inverse && inverse_prunes(next, move)) {
+#ifdef SOLVE_STATS
+            stats.pruned_inverse++;
+#endif
+            return Exponent;
+        }
+#ifdef SOLVE_STATS
+        stats.expanded[stats_depth()]++;
+#endif
+        remaining_depth--;
+        next->equal_by_sequence = current->equal_by_sequence & EqualBy[move];
+        next->axis = U;
+        next->exponent = 0;
+        current = next;
+        if (has_discardable_neighbour_axis()) {
+#ifdef SOLVE_STATS
+            stats.pruned_neighbour_axis++;
+#endif
+            next->exponent = 1;
+            return Axis;
+        }
+        return Exponent;
+    }
+
+    // what visit returns when the pruning values cut a node
+    inline ShouldIncrease pruned(ShouldIncrease should_increase) {
+#ifdef SOLVE_STATS
+        if (should_increase == Axis) {
+            stats.pruned_axis++;
+        } else {
+            stats.pruned_exponent++;
+        }
+#endif
+        return should_increase;
+    }
+
+    // starts the search of solution_innerloop, to be run by calls to step
+    void begin_steps(Permutation& p) {
+        reinitialize(p);
+        floor = &states[0];
+        deepen = true;
+        step_should_increase = Exponent;
+        step_pending = false;
+    }
+
+    // The search of solution_innerloop cut in steps, so that one thread may
+    // interleave several searches (see InterleavedCubeSolver). Each call
+    // finishes the node reached by the previous one, then picks the next node
+    // and only prefetches its pruning entries, which are most likely not in
+    // any cache: they have time to arrive while the other searches step
+    inline SearchStep step() {
+        if (step_pending) {
+            step_pending = false;
+            CubeState* next = current + 1;
+            next->ud_pruning =
+                RelativePruning[current->ud_pruning]
+                               [(*pending_entries[0] >> pending_shifts[0]) & 3];
+            next->fb_pruning =
+                RelativePruning[current->fb_pruning]
+                               [(*pending_entries[1] >> pending_shifts[1]) & 3];
+            next->lr_pruning =
+                RelativePruning[current->lr_pruning]
+                               [(*pending_entries[2] >> pending_shifts[2]) & 3];
+#ifdef SOLVE_STATS
+            stats.generated[stats_depth()]++;
+            stats.table_lookups += 3;
+#endif
+            if (--nodes_until_check == 0 && limits_reached()) {
+                record_iteration();
+                return Stopped;
+            }
+            step_should_increase = visit(next, step_move);
+            if (step_should_increase == Nothing) {
+                record_iteration();
+                return Found;
+            }
+        }
+        if (!advance(step_should_increase, step_move)) {
+            record_iteration();
+            return Stopped;
+        }
+        CubeState* next = current + 1;
+        move_coordinates(next, step_move);
+        pending_entries[0] =
+            table->locate(next->ud_coord, next->ud_edge_orientation,
+                          next->ud_corner_orientation, &pending_shifts[0]);
+        pending_entries[1] =
+            table->locate(next->fb_coord, next->fb_edge_orientation,
+                          next->fb_corner_orientation, &pending_shifts[1]);
+        pending_entries[2] =
+            table->locate(next->lr_coord, next->lr_edge_orientation,
+                          next->lr_corner_orientation, &pending_shifts[2]);
+        for (int i = 0; i < 3; i++) {
+            __builtin_prefetch(pending_entries[i]);
+        }
+        step_pending = true;
+        return Pending;
+    }
+
+    // looks for the solutions of boundary + 1 moves which start with
+    // `prefix`. states[0] must already hold the cube (see reinitialize), and
+    // the prefix must only hold moves the search itself would try. false if
+    // there is none, or if stopped by the limits
+    bool search_subtree(const int* prefix, int length, int boundary) {
+        if (SolveStatsEnabled) {
+            iteration_started_at = SolveClock();
+        }
+        current = &states[0];
+        for (int i = 0; i < length; i++) {
+            current->axis = prefix[i] % 6;
+            current->exponent = prefix[i] / 6 + 1;
+            execute_move(current + 1, prefix[i]);
+            if (use_inverse) {
+                (current + 1)->inverse = Permutation::mult(
+                    CanonicalPermutation[InverseMove(prefix[i])],
+                    current->inverse);
+            }
+            (current + 1)->equal_by_sequence =
+                current->equal_by_sequence & EqualBy[prefix[i]];
+            current++;
+        }
+        boundary_depth = boundary;
+        remaining_depth = boundary - length;
+        floor = current;
+        deepen = false;
+        current->axis = U;
+        current->exponent = 0;
+        bool found;
+        if (has_discardable_neighbour_axis()) {
+            current->exponent = 1;
+            found = search(Axis);
+        } else {
+            found = search(Exponent);
+        }
+        record_iteration();
+        return found;
+    }
+
+    // resets the limits and the node count before a search
+    void begin(SolveLimits limits) {
+        this->limits = limits;
+        status = Solved;
+        boundary_depth = 0;
+        nodes_until_check = SolveCheckInterval;
+        nodes_checked = 0;
+        if (SolveStatsEnabled) {
+            stats = SolveStats{};
+        }
+    }
+
+    // nodes expanded since begin
+    uint64_t node_count() {
+        return nodes_checked + SolveCheckInterval - nodes_until_check;
+    }
+
+    // the moves from states[0] to current, once a search succeeded
+    CubeSolution found_solution() {
+        int length = current - &states[0] + 1;
+        CubeSolution solution{length};
+        solution.nodes = node_count();
+        solution.stats = stats;
+        for (int i = 0; i < length; i++) {
+            solution.move_indexes[i] =
+                AxisExponent2Move[states[i].axis][states[i].exponent];
+        }
+        return solution;
     }
 
     CubeSolution solve(Permutation& cube) {
+        return solve(cube, SolveLimits{});
+    }
+
+    // gives up once `limits` are reached, returning a solution without moves
+    // which tells how deep the search went
+    CubeSolution solve(Permutation& cube, SolveLimits limits) {
         if (Permutation::equals(cube, Permutation::identity())) {
             CubeSolution solution{0};
             return solution;
         }
-        solution_innerloop(cube);
-        int length = 0;
-        for (CubeState* i = &states[0]; i <= current; i++) {
-            length++;
+        begin(limits);
+        // the request may have expired before the search starts
+        if (limits_reached()) {
+            CubeSolution solution{0};
+            solution.status = status;
+            return solution;
         }
-        CubeSolution solution{length};
-        int index = 0;
-        for (CubeState* i = &states[0]; i <= current; i++) {
-            solution.move_indexes.push_back(
-                AxisExponent2Move[i->axis][i->exponent]);
-            solution.moves.push_back(
-                CanonicalPermutation[solution.move_indexes[index]]);
-            solution.move_names =
-                solution.move_names +
-                CanonicalPermutationName[solution.move_indexes[index]] + " ";
-            index++;
+        bool found = solution_innerloop(cube);
+        record_iteration();
+        if (!found) {
+            CubeSolution solution{0};
+            solution.status = status;
+            solution.searched_depth = boundary_depth;
+            solution.nodes = node_count();
+            solution.stats = stats;
+            return solution;
         }
-        return solution;
+        return found_solution();
     }
 };
 
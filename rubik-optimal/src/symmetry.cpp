@@ -226,14 +226,14 @@ int* FullInverseSymmetryIndex;
 const Permutation* FullInverseSymmetry =
     _build_full_inverse_symmetry(&FullInverseSymmetryIndex);
 
-Permutation SymmetryConjugate(Permutation p, int symmetry) {
-    return Permutation::mult_vector(
-        {Symmetry[symmetry], p, InverseSymmetry[symmetry]});
+Permutation SymmetryConjugate(const Permutation& p, int symmetry) {
+    return Permutation::mult(Permutation::mult(Symmetry[symmetry], p),
+                             InverseSymmetry[symmetry]);
 }
 
-Permutation FullSymmetryConjugate(Permutation p, int symmetry) {
-    return Permutation::mult_vector(
-        {FullSymmetry[symmetry], p, FullInverseSymmetry[symmetry]});
+Permutation FullSymmetryConjugate(const Permutation& p, int symmetry) {
+    return Permutation::mult(Permutation::mult(FullSymmetry[symmetry], p),
+                             FullInverseSymmetry[symmetry]);
 }
 
 // Only for one of the compatible simmetries (16 in total)
@@ -0,0 +1,223 @@
+#ifndef __TABLEBUNDLE__
+#define __TABLEBUNDLE__
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fstream>
+#include <string>
+
+using namespace std;
+
+// The move, conjugate and two-phase pruning tables are derived from the cube
+// model at static-init time, which takes seconds (EdgeOrientationConjugate
+// most of all). buildtable saves them all to table_bundle.bin, next to
+// pruning_table.bin, and later processes map that file instead.
+//
+// A table is built in process when the bundle is missing, of another
+// version, saved from other table sources, or holds no table of that name
+// and size with a matching checksum
+
+// A checksum of the sources the tables are computed from, which compile.sh
+// passes as -DTABLE_SOURCE_HASH: any change to them makes older bundles
+// stale. Processes built without it do not map TableBundleFile, since they
+// cannot tell
+#ifndef TABLE_SOURCE_HASH
+#define TABLE_SOURCE_HASH 0
+#endif
+const uint64_t TableSourceHash = TABLE_SOURCE_HASH;
+
+const char TableBundleFile[] = "table_bundle.bin";
+// bump whenever the layout of the file changes
+const uint32_t TableBundleVersion = 2;
+const char TableBundleMagic[8] = {'R', 'U', 'B', 'I', 'K', 'T', 'B', 0};
+const int TableBundleMaxTables = 32;
+const int TableBundleNameLength = 40;
+// tables start on cache lines, as _allocate_table's do
+const size_t TableBundleAlignment = 64;
+
+struct TableBundleEntry {
+    char name[TableBundleNameLength];
+    /* from the start of the file */
+    uint64_t offset;
+    uint64_t size;
+    uint64_t checksum;
+};
+
+struct TableBundleHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;
+    uint64_t source_hash;
+    TableBundleEntry entries[TableBundleMaxTables];
+};
+
+// FNV-1a, a word at a time
+inline uint64_t TableChecksum(const char* data, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        hash = (hash ^ word) * 0x100000001B3ULL;
+    }
+    for (; i < size; i++) {
+        hash = (hash ^ (unsigned char)data[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+struct TableBundle {
+    /* the mapped bundle, nullptr if none could be used */
+    const char* mapped = nullptr;
+    size_t mapped_size = 0;
+    /* every table of this process, mapped or built, for save */
+    TableBundleEntry tables[TableBundleMaxTables];
+    const char* table_data[TableBundleMaxTables];
+    int table_count = 0;
+    /* how many of them came from the bundle */
+    int mapped_count = 0;
+
+    // Maps `filename` read-only. false if it cannot be mapped, or is not a
+    // bundle of this version and of these table sources
+    bool open(const char* filename) {
+        close_mapping();
+        int fd = ::open(filename, O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat file_stat;
+        if (fstat(fd, &file_stat) < 0 ||
+            (size_t)file_stat.st_size < sizeof(TableBundleHeader)) {
+            ::close(fd);
+            return false;
+        }
+        void* data = mmap(nullptr, file_stat.st_size, PROT_READ, MAP_SHARED,
+                          fd, 0);
+        // the mapping outlives the descriptor
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return false;
+        }
+        mapped = (const char*)data;
+        mapped_size = file_stat.st_size;
+        const TableBundleHeader* header = (const TableBundleHeader*)mapped;
+        if (memcmp(header->magic, TableBundleMagic, 8) != 0 ||
+            header->version != TableBundleVersion ||
+            header->source_hash != TableSourceHash ||
+            header->count > TableBundleMaxTables) {
+            close_mapping();
+            return false;
+        }
+        return true;
+    }
+
+    void close_mapping() {
+        if (mapped != nullptr) {
+            munmap((void*)mapped, mapped_size);
+            mapped = nullptr;
+            mapped_size = 0;
+        }
+    }
+
+    // the bundled table `name` of `size` bytes, nullptr unless it is there
+    // and intact
+    const char* find(const char* name, size_t size) {
+        if (mapped == nullptr) {
+            return nullptr;
+        }
+        const TableBundleHeader* header = (const TableBundleHeader*)mapped;
+        for (uint32_t i = 0; i < header->count; i++) {
+            const TableBundleEntry& entry = header->entries[i];
+            if (strncmp(entry.name, name, TableBundleNameLength) != 0) {
+                continue;
+            }
+            if (entry.size != size || entry.offset > mapped_size ||
+                mapped_size - entry.offset < size ||
+                TableChecksum(mapped + entry.offset, size) != entry.checksum) {
+                return nullptr;
+            }
+            return mapped + entry.offset;
+        }
+        return nullptr;
+    }
+
+    // remembers a table of this process, to be saved
+    void add(const char* name, const char* data, size_t size) {
+        if (table_count == TableBundleMaxTables) {
+            return;
+        }
+        TableBundleEntry& entry = tables[table_count];
+        memset(&entry, 0, sizeof(entry));
+        strncpy(entry.name, name, TableBundleNameLength - 1);
+        entry.size = size;
+        table_data[table_count++] = data;
+    }
+
+    // writes every table of this process to a new file and renames it over
+    // `filename`: processes which mapped the old one keep it intact
+    bool save(string filename) {
+        TableBundleHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, TableBundleMagic, 8);
+        header.version = TableBundleVersion;
+        header.source_hash = TableSourceHash;
+        header.count = table_count;
+        uint64_t offset = sizeof(header);
+        for (int i = 0; i < table_count; i++) {
+            offset = (offset + TableBundleAlignment - 1) /
+                     TableBundleAlignment * TableBundleAlignment;
+            header.entries[i] = tables[i];
+            header.entries[i].offset = offset;
+            header.entries[i].checksum =
+                TableChecksum(table_data[i], tables[i].size);
+            offset += tables[i].size;
+        }
+
+        string temporary = filename + ".tmp";
+        ofstream output(temporary, ios::binary);
+        output.write((const char*)&header, sizeof(header));
+        uint64_t written = sizeof(header);
+        const char padding[TableBundleAlignment] = {0};
+        for (int i = 0; i < table_count; i++) {
+            output.write(padding, header.entries[i].offset - written);
+            output.write(table_data[i], tables[i].size);
+            written = header.entries[i].offset + tables[i].size;
+        }
+        output.close();
+        if (!output) {
+            remove(temporary.c_str());
+            return false;
+        }
+        return rename(temporary.c_str(), filename.c_str()) == 0;
+    }
+};
+
+// TableBundleFile of the working directory (where pruning_table.bin is
+// looked for too), mapped on first use
+TableBundle& GetTableBundle() {
+    static TableBundle* bundle = [] {
+        TableBundle* res = new TableBundle();
+        if (TableSourceHash != 0) {
+            res->open(TableBundleFile);
+        }
+        return res;
+    }();
+    return *bundle;
+}
+
+// The table `build()` returns, `size` bytes long, mapped from the bundle
+// instead when it holds it. Mapped tables are read-only
+template <typename Table, typename Build>
+Table BundledTable(const char* name, size_t size, Build build) {
+    TableBundle& bundle = GetTableBundle();
+    const char* found = bundle.find(name, size);
+    Table table = found != nullptr ? (Table)(char*)found : build();
+    bundle.add(name, (const char*)table, size);
+    bundle.mapped_count += found != nullptr;
+    return table;
+}
+
+#endif
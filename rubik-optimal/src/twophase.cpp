@@ -0,0 +1,514 @@
+#ifndef __TWO_PHASE__
+#define __TWO_PHASE__
+
+#include <string.h>
+#include <vector>
+#include "movetable.cpp"
+#include "solve.cpp"
+
+// Kociemba's two-phase algorithm: a first search takes the cube into
+// G1 = <U, D, R2, L2, F2, B2>, where every orientation is solved and the UD
+// slice edges are in the slice, and a second one solves it with the moves of
+// G1 only. Both searches are short and have small, exact pruning tables (a
+// few megabytes, built at startup), so a solution comes in about a
+// millisecond (median; one cube in a hundred takes ten), at the cost of a
+// few moves more than the optimal one (see two_phase_benchmark in main.cpp).
+
+// solutions are searched up to this many moves. Random cubes nearly always
+// have one, so lowering it costs time rather than failures
+const int TwoPhaseMaxLength = 22;
+
+// longer second phases are not searched: a longer first phase which needs a
+// shorter second one is nearly always found soon after
+const int TwoPhaseMaxPhase2Length = 12;
+
+// the moves of G1
+const int Phase2Moves[] = {U, U2, Ui, D, D2, Di, R2, L2, F2, B2};
+const int Phase2MoveCount = 10;
+
+bool* _build_is_phase2_move() {
+    bool* res = new bool[CanonicalPermutationLength];
+    for (int i = 0; i < CanonicalPermutationLength; i++) {
+        res[i] = false;
+    }
+    for (int i = 0; i < Phase2MoveCount; i++) {
+        res[Phase2Moves[i]] = true;
+    }
+    return res;
+}
+
+// bool[canonical move]. Whether the move belongs to G1
+bool* IsPhase2Move = _build_is_phase2_move();
+
+int* _build_all_moves() {
+    int* res = new int[CanonicalPermutationLength];
+    for (int i = 0; i < CanonicalPermutationLength; i++) {
+        res[i] = i;
+    }
+    return res;
+}
+
+int* AllMoves = _build_all_moves();
+
+Permutation _two_phase_solved = Permutation::identity();
+
+// UDSliceSortedCoordinate = UDSliceCoordinate * 24 + slice permutation
+const int SolvedUDSlice = UDSliceSortedCoordinate(_two_phase_solved) / 24;
+const int SolvedSlicePermutation =
+    SlicePermutationCoordinate(_two_phase_solved);
+const int SolvedUEdgePosition = UEdgePositionCoordinate(_two_phase_solved);
+const int SolvedUCornerPosition =
+    UCornerPositionCoordinate(_two_phase_solved);
+
+MoveTable _build_ud_slice_move() {
+    MoveTable res = _allocate_table<CanonicalPermutationLength>(495);
+    Permutation inv, moved;
+    for (int i = 0; i < 495; i++) {
+        inv = UDSliceSortedCoordinateInverse(i * 24);
+        for (int j = 0; j < CanonicalPermutationLength; j++) {
+            moved = Permutation::mult(inv, CanonicalPermutation[j]);
+            res[i][j] = UDSliceCoordinate(moved);
+        }
+    }
+    return res;
+}
+
+// uint16_t[495][canonical move]. Where the 4 UD slice edges are, whatever
+// their order
+MoveTable UDSliceMove =
+    BundledTable<MoveTable>("UDSliceMove",
+                            _table_size<CanonicalPermutationLength>(495),
+                            _build_ud_slice_move);
+
+MoveTable _build_ud_edge_permutation_move() {
+    MoveTable res = _allocate_table<CanonicalPermutationLength>(
+        UDEdgePermutationCoordinateLength);
+    Permutation inv, moved;
+    for (int i = 0; i < UDEdgePermutationCoordinateLength; i++) {
+        inv = UDEdgePermutationCoordinateInverse(i);
+        for (int j = 0; j < Phase2MoveCount; j++) {
+            moved =
+                Permutation::mult(inv, CanonicalPermutation[Phase2Moves[j]]);
+            res[i][Phase2Moves[j]] = UDEdgePermutationCoordinate(moved);
+        }
+    }
+    return res;
+}
+
+// uint16_t[40320][canonical move], phase 2 moves only
+MoveTable UDEdgePermutationMove = BundledTable<MoveTable>(
+    "UDEdgePermutationMove",
+    _table_size<CanonicalPermutationLength>(UDEdgePermutationCoordinateLength),
+    _build_ud_edge_permutation_move);
+
+MoveTable _build_slice_permutation_move() {
+    MoveTable res = _allocate_table<CanonicalPermutationLength>(
+        SlicePermutationCoordinateLength);
+    Permutation inv, moved;
+    for (int i = 0; i < SlicePermutationCoordinateLength; i++) {
+        inv = UDSliceSortedCoordinateInverse(SolvedUDSlice * 24 + i);
+        for (int j = 0; j < Phase2MoveCount; j++) {
+            moved =
+                Permutation::mult(inv, CanonicalPermutation[Phase2Moves[j]]);
+            res[i][Phase2Moves[j]] = SlicePermutationCoordinate(moved);
+        }
+    }
+    return res;
+}
+
+// uint16_t[24][canonical move], phase 2 moves only
+MoveTable SlicePermutationMove = BundledTable<MoveTable>(
+    "SlicePermutationMove",
+    _table_size<CanonicalPermutationLength>(SlicePermutationCoordinateLength),
+    _build_slice_permutation_move);
+
+int* _build_u_edge_position() {
+    int* res = new int[UDEdgePermutationCoordinateLength];
+    Permutation p;
+    for (int i = 0; i < UDEdgePermutationCoordinateLength; i++) {
+        p = UDEdgePermutationCoordinateInverse(i);
+        res[i] = UEdgePositionCoordinate(p);
+    }
+    return res;
+}
+
+// int[UD edge permutation]. Its UEdgePositionCoordinate
+int* UEdgePosition = _build_u_edge_position();
+
+int* _build_u_corner_position() {
+    int* res = new int[CornerPermutationCoordinateLength];
+    Permutation p;
+    for (int i = 0; i < CornerPermutationCoordinateLength; i++) {
+        p = CornerPermutationCoordinateInverse(i);
+        res[i] = UCornerPositionCoordinate(p);
+    }
+    return res;
+}
+
+// int[corner permutation]. Its UCornerPositionCoordinate
+int* UCornerPosition = _build_u_corner_position();
+
+// The move table of `projection`, a function of the coordinate `move` is
+// for, from any coordinate of each projected value
+MoveTable _build_projected_move(MoveTable move,
+                                int length,
+                                int* projection,
+                                int projected_length) {
+    MoveTable res =
+        _allocate_table<CanonicalPermutationLength>(projected_length);
+    for (int i = 0; i < length; i++) {
+        for (int j = 0; j < Phase2MoveCount; j++) {
+            int m = Phase2Moves[j];
+            res[projection[i]][m] = projection[move[i][m]];
+        }
+    }
+    return res;
+}
+
+// uint16_t[70][canonical move], phase 2 moves only
+MoveTable UEdgePositionMove = BundledTable<MoveTable>(
+    "UEdgePositionMove",
+    _table_size<CanonicalPermutationLength>(FourOfEightCoordinateLength),
+    [] {
+        return _build_projected_move(UDEdgePermutationMove,
+                                     UDEdgePermutationCoordinateLength,
+                                     UEdgePosition,
+                                     FourOfEightCoordinateLength);
+    });
+
+// uint16_t[70][canonical move], phase 2 moves only
+MoveTable UCornerPositionMove = BundledTable<MoveTable>(
+    "UCornerPositionMove",
+    _table_size<CanonicalPermutationLength>(FourOfEightCoordinateLength),
+    [] {
+        return _build_projected_move(CornerPermutationMove,
+                                     CornerPermutationCoordinateLength,
+                                     UCornerPosition,
+                                     FourOfEightCoordinateLength);
+    });
+
+// Exact number of moves to solve both coordinates at once, at
+// [a * b_length + b], by a breadth-first search from the solved pair
+int8_t* _build_pair_pruning(MoveTable a_move,
+                            int a_length,
+                            int a_solved,
+                            MoveTable b_move,
+                            int b_length,
+                            int b_solved,
+                            const int* moves,
+                            int move_count) {
+    int8_t* res = new int8_t[a_length * b_length];
+    memset(res, -1, a_length * b_length);
+    vector<int> queue;
+    queue.reserve(a_length * b_length);
+    res[a_solved * b_length + b_solved] = 0;
+    queue.push_back(a_solved * b_length + b_solved);
+    for (size_t i = 0; i < queue.size(); i++) {
+        int a = queue[i] / b_length;
+        int b = queue[i] % b_length;
+        for (int k = 0; k < move_count; k++) {
+            int next = a_move[a][moves[k]] * b_length + b_move[b][moves[k]];
+            if (res[next] < 0) {
+                res[next] = res[queue[i]] + 1;
+                queue.push_back(next);
+            }
+        }
+    }
+    return res;
+}
+
+// _build_pair_pruning's table, bundled as `name` (see BundledTable)
+int8_t* _bundled_pair_pruning(const char* name,
+                              MoveTable a_move,
+                              int a_length,
+                              int a_solved,
+                              MoveTable b_move,
+                              int b_length,
+                              int b_solved,
+                              const int* moves,
+                              int move_count) {
+    return BundledTable<int8_t*>(name, (size_t)a_length * b_length, [&] {
+        return _build_pair_pruning(a_move, a_length, a_solved, b_move,
+                                   b_length, b_solved, moves, move_count);
+    });
+}
+
+// int8_t[twist * 495 + UD slice]
+int8_t* TwistSlicePruning = _bundled_pair_pruning(
+    "TwistSlicePruning",
+    CornerOrientationMove, CornerOrientationCoordinateLength, 0, UDSliceMove,
+    495, SolvedUDSlice, AllMoves, CanonicalPermutationLength);
+
+// int8_t[flip * 495 + UD slice]
+int8_t* FlipSlicePruning = _bundled_pair_pruning(
+    "FlipSlicePruning",
+    EdgeOrientationMove, EdgeOrientationCoordinateLength, 0, UDSliceMove, 495,
+    SolvedUDSlice, AllMoves, CanonicalPermutationLength);
+
+// int8_t[twist * 2048 + flip]
+int8_t* TwistFlipPruning = _bundled_pair_pruning(
+    "TwistFlipPruning",
+    CornerOrientationMove, CornerOrientationCoordinateLength, 0,
+    EdgeOrientationMove, EdgeOrientationCoordinateLength, 0, AllMoves,
+    CanonicalPermutationLength);
+
+// int8_t[corner permutation * 24 + slice permutation], within G1
+int8_t* CornerSlicePruning = _bundled_pair_pruning(
+    "CornerSlicePruning",
+    CornerPermutationMove, CornerPermutationCoordinateLength, 0,
+    SlicePermutationMove, SlicePermutationCoordinateLength,
+    SolvedSlicePermutation, Phase2Moves, Phase2MoveCount);
+
+// int8_t[UD edge permutation * 24 + slice permutation], within G1
+int8_t* EdgeSlicePruning = _bundled_pair_pruning(
+    "EdgeSlicePruning",
+    UDEdgePermutationMove, UDEdgePermutationCoordinateLength, 0,
+    SlicePermutationMove, SlicePermutationCoordinateLength,
+    SolvedSlicePermutation, Phase2Moves, Phase2MoveCount);
+
+// int8_t[corner permutation * 70 + U edge position], within G1
+int8_t* CornerUEdgePruning = _bundled_pair_pruning(
+    "CornerUEdgePruning",
+    CornerPermutationMove, CornerPermutationCoordinateLength, 0,
+    UEdgePositionMove, FourOfEightCoordinateLength, SolvedUEdgePosition,
+    Phase2Moves, Phase2MoveCount);
+
+// int8_t[UD edge permutation * 70 + U corner position], within G1
+int8_t* EdgeUCornerPruning = _bundled_pair_pruning(
+    "EdgeUCornerPruning",
+    UDEdgePermutationMove, UDEdgePermutationCoordinateLength, 0,
+    UCornerPositionMove, FourOfEightCoordinateLength, SolvedUCornerPosition,
+    Phase2Moves, Phase2MoveCount);
+
+// the cube as searched by each variant of TwoPhaseSolver: seen from the UD,
+// FB and LR axes, then its inverse from the same axes
+const int TwoPhaseVariantCount = 6;
+const int TwoPhaseVariantSymmetry[3] = {0, fb_transform, lr_transform};
+
+// Finds a short solution fast, not necessarily an optimal one: the first one
+// of at most max_length moves, else the first one of max_length + 1 moves,
+// and so on up to SolutionMaxLength, past which the search is Exhausted. One
+// per thread, like CubeSolver.
+//
+// How long the search takes depends a lot on how the cube sits with respect
+// to G1, so the cube is searched from the three axes, and so is its inverse,
+// whose solution is the reversed inverse: each length of the first phase is
+// tried on every variant before the next one, and the luckiest one wins.
+struct TwoPhaseSolver {
+    int max_length = TwoPhaseMaxLength;
+    /* the length searched up to, max_length unless there was no solution.
+       Never beyond SolutionMaxLength: the search is Exhausted there */
+    int limit;
+    Permutation variants[TwoPhaseVariantCount];
+    /* the variant being searched */
+    int variant;
+    /* moves of both phases, one after the other */
+    int moves[SolutionMaxLength];
+    int length;
+    SolveLimits limits;
+    SolveStatus status = Solved;
+    uint64_t nodes = 0;
+
+    // same as CubeSolver::solve. When stopped by the limits, the solution
+    // says nothing about how short one could be (searched_depth is 0)
+    CubeSolution solve(Permutation& cube, SolveLimits limits = SolveLimits{}) {
+        this->limits = limits;
+        status = Solved;
+        nodes = 0;
+        length = -1;
+        Permutation inverse = Permutation::inverse(cube);
+        int twists[TwoPhaseVariantCount];
+        int flips[TwoPhaseVariantCount];
+        int slices[TwoPhaseVariantCount];
+        for (int v = 0; v < TwoPhaseVariantCount; v++) {
+            Permutation& p = v < 3 ? cube : inverse;
+            variants[v] = v % 3 == 0
+                              ? p
+                              : FullSymmetryConjugate(
+                                    p, TwoPhaseVariantSymmetry[v % 3]);
+            twists[v] = CornerOrientationCoordinate(variants[v]);
+            flips[v] = EdgeOrientationCoordinate(variants[v]);
+            slices[v] = UDSliceCoordinate(variants[v]);
+        }
+        // the request may have expired before the search starts
+        limits_reached();
+        for (limit = max_length; length < 0 && status == Solved; limit++) {
+            if (limit > SolutionMaxLength) {
+                status = Exhausted;
+                break;
+            }
+            // past max_length, only first phases which may now be followed
+            // by a longer second one are searched again (see phase2)
+            int shortest_phase1 =
+                limit == max_length
+                    ? 0
+                    : max(0, limit - TwoPhaseMaxPhase2Length);
+            for (int phase1_length = shortest_phase1;
+                 phase1_length <= limit && length < 0 && status == Solved;
+                 phase1_length++) {
+                for (variant = 0; variant < TwoPhaseVariantCount; variant++) {
+                    if (phase1_pruning(twists[variant], flips[variant],
+                                       slices[variant]) <= phase1_length &&
+                        phase1(twists[variant], flips[variant],
+                               slices[variant], 0, phase1_length)) {
+                        break;
+                    }
+                }
+            }
+        }
+        CubeSolution solution{length < 0 ? 0 : length};
+        solution.status = status;
+        solution.nodes = nodes;
+        solution.optimal = length == 0;
+        for (int i = 0; i < length; i++) {
+            solution.move_indexes[i] = original_move(i);
+        }
+        return solution;
+    }
+
+    // the i-th move of the solution, for the cube given to solve
+    int original_move(int i) {
+        int move = variant < 3 ? moves[i] : InverseMove(moves[length - 1 - i]);
+        if (variant % 3 == 0) {
+            return move;
+        }
+        // the variant is S cube S^-1, so its moves are conjugated likewise
+        for (int m = 0; m < CanonicalPermutationLength; m++) {
+            if (FullCanonicalPermutationConjugate
+                    [m][TwoPhaseVariantSymmetry[variant % 3]] == move) {
+                return m;
+            }
+        }
+        return move;
+    }
+
+    inline int phase1_pruning(int twist, int flip, int slice) {
+        return max(max(TwistSlicePruning[twist * 495 + slice],
+                       FlipSlicePruning[flip * 495 + slice]),
+                   TwistFlipPruning[twist * 2048 + flip]);
+    }
+
+    inline int phase2_pruning(int corners, int edges, int slice) {
+        return max(max(CornerSlicePruning[corners * 24 + slice],
+                       EdgeSlicePruning[edges * 24 + slice]),
+                   max(CornerUEdgePruning[corners * 70 + UEdgePosition[edges]],
+                       EdgeUCornerPruning[edges * 70 +
+                                          UCornerPosition[corners]]));
+    }
+
+    // same as CubeSolver: no two moves of the same axis in a row, and of two
+    // opposite axes, U before D, R before L and F before B
+    inline bool discardable(int depth, int move) {
+        if (depth == 0) {
+            return false;
+        }
+        int previous_axis = moves[depth - 1] % 6;
+        return move % 6 == previous_axis || move % 6 + 3 == previous_axis;
+    }
+
+    // true iff the search must stop, because of a solution or of the limits
+    bool phase1(int twist, int flip, int slice, int depth, int remaining) {
+        if (remaining == 0) {
+            // else a shorter first phase already led here
+            if (depth > 0 && IsPhase2Move[moves[depth - 1]]) {
+                return false;
+            }
+            return phase2(depth);
+        }
+        for (int move = 0; move < CanonicalPermutationLength; move++) {
+            if (discardable(depth, move)) {
+                continue;
+            }
+            int next_twist = CornerOrientationMove[twist][move];
+            int next_flip = EdgeOrientationMove[flip][move];
+            int next_slice = UDSliceMove[slice][move];
+            if (count_node()) {
+                return true;
+            }
+            if (phase1_pruning(next_twist, next_flip, next_slice) >
+                remaining - 1) {
+                continue;
+            }
+            moves[depth] = move;
+            if (phase1(next_twist, next_flip, next_slice, depth + 1,
+                       remaining - 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // searches the second phase after the first `depth` moves, which lead
+    // into G1
+    bool phase2(int depth) {
+        Permutation p = variants[variant];
+        for (int i = 0; i < depth; i++) {
+            p = Permutation::mult(p, CanonicalPermutation[moves[i]]);
+        }
+        int corners = CornerPermutationCoordinate(p);
+        int edges = UDEdgePermutationCoordinate(p);
+        int slice = SlicePermutationCoordinate(p);
+        int longest = min(limit - depth, TwoPhaseMaxPhase2Length);
+        // the previous limits searched every shorter second phase already
+        int shortest = limit == max_length ? 0 : limit - depth;
+        for (int phase2_length =
+                 max(phase2_pruning(corners, edges, slice), shortest);
+             phase2_length <= longest; phase2_length++) {
+            if (phase2(corners, edges, slice, depth, phase2_length)) {
+                if (status == Solved) {
+                    length = depth + phase2_length;
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool phase2(int corners, int edges, int slice, int depth, int remaining) {
+        if (remaining == 0) {
+            // the pruning values are exact: the cube is solved
+            return true;
+        }
+        for (int k = 0; k < Phase2MoveCount; k++) {
+            int move = Phase2Moves[k];
+            if (discardable(depth, move)) {
+                continue;
+            }
+            int next_corners = CornerPermutationMove[corners][move];
+            int next_edges = UDEdgePermutationMove[edges][move];
+            int next_slice = SlicePermutationMove[slice][move];
+            if (count_node()) {
+                return true;
+            }
+            if (phase2_pruning(next_corners, next_edges, next_slice) >
+                remaining - 1) {
+                continue;
+            }
+            moves[depth] = move;
+            if (phase2(next_corners, next_edges, next_slice, depth + 1,
+                       remaining - 1)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // true iff the search must stop. Checks the limits every
+    // SolveCheckInterval nodes
+    inline bool count_node() {
+        return ++nodes % SolveCheckInterval == 0 && limits_reached();
+    }
+
+    // true iff the search must stop. Sets status accordingly
+    bool limits_reached() {
+        if (limits.cancelled != nullptr &&
+            limits.cancelled->load(std::memory_order_relaxed)) {
+            status = Cancelled;
+        } else if (limits.deadline != 0 && SolveClock() >= limits.deadline) {
+            status = TimedOut;
+        }
+        return status != Solved;
+    }
+};
+
+#endif
@@ -1,25 +1,136 @@
 /**
- * Usage: ./server server_port worker_count
+ * Usage: ./server server_port worker_count [--shards=N] [--affinity]
+ *                 [--io=epoll|uring] [--cache=MEGABYTES] [--cache-inverse]
+ *                 [--queue-limit=N] [--codel-target=MS] [--codel-interval=MS]
+ *                 [--timeout=MS] [--admin-port=PORT] [--parallel=N]
+ *                 [--populate]
  *
  * Creates a server listening on `server_port` that accepts payloads from
  * clients containing a hash of a rubik cube. The server finds the moves
  * necessary to solve the cube and sends them back to the client.
  *
- * The server creates 'worker_count' threads to handle clients. Each one
- * loops connecting to a client, solving the rubik cube and
- * sending the response back to the client.
+ * The main thread runs an edge-triggered epoll event loop which owns every
+ * socket: it accepts clients, reads their payloads without blocking and turns
+ * them into cubes. Only fully parsed cubes are handed to the 'worker_count'
+ * solver threads, so a slow or idle client never holds a solver hostage.
+ * Workers hand solutions back to the event loop, which writes them to the
+ * client.
+ *
+ * Connections are kept open until the client closes them, so one connection
+ * may carry many payloads. A payload of the form "id;hash" gets a reply of
+ * the form "id;moves", which allows the client to send several cubes back to
+ * back: replies come back in the order the cubes got solved, not in the order
+ * they were sent.
+ *
+ * Solutions are optimal, unless the payload starts with "fast;" (after the
+ * id, if any) or the binary frame has PROTOCOL_FLAG_FAST: the cube is then
+ * solved by the two-phase solver (twophase.cpp) in about a millisecond
+ * (median; 9.3 ms for one cube in a hundred, 17 ms for the slowest of 500
+ * random cubes), with a few moves more than needed. Such solutions are not
+ * cached, but a cached optimal solution is used for them too.
+ *
+ * A payload starting with "anytime=MS;" (after the id, if any), or a binary
+ * frame with PROTOCOL_FLAG_ANYTIME, is solved by the anytime solver
+ * (anytimesolve.cpp): a two-phase solution comes first, then the optimal
+ * search looks for a shorter one for at most MS milliseconds. Binary replies
+ * carry REPLY_FLAG_UNPROVEN when the solution may not be optimal. Only
+ * solutions known to be optimal are cached.
+ *
+ * Clients may also speak the binary protocol described in protocol.h, whose
+ * frames start with a magic byte and carry the cube as 20 cubie bytes or as
+ * a few coordinates. Each frame is recognized on its own, so both protocols
+ * may be mixed on the same connection.
+ *
+ * Requests and replies travel between the event loop and the workers through
+ * the bounded lock-free rings of queue.h. When the request ring is full the
+ * event loop stops reading from the connection instead of blocking, and picks
+ * it up again once workers made room.
+ *
+ * With --shards=N the server is split into N shards, each one with its own
+ * SO_REUSEPORT listening socket, event loop thread, rings and share of the
+ * workers: the kernel spreads new connections among the shards, and nothing
+ * but the pruning table is shared between them. --affinity pins the threads
+ * of each shard to one CPU.
+ *
+ * --io=uring replaces epoll with io_uring (see uring.h): clients are taken by
+ * a multishot accept, received into a ring of provided buffers, and every
+ * accept, receive, send and close prepared while handling a batch of
+ * completions is submitted with a single system call. Parsing, dispatch to
+ * the workers and reply formatting are shared by both backends.
+ *
+ * --cache=MEGABYTES puts a solution cache (cache.h) of that size in front of
+ * the solver. It is keyed by cube up to the 48 symmetries of the whole cube,
+ * and with --cache-inverse up to inversion too, so a cube only needs solving
+ * once for all of its symmetric variants.
+ *
+ * Under overload the server sheds requests instead of letting them queue up
+ * without bound. A shed request gets a STATUS_BUSY reply (protocol.h), or
+ * "[id;]BUSY ms" in the text protocol, telling after how many milliseconds
+ * the client should try again. --queue-limit=N refuses requests as soon as N
+ * of them wait for a worker. --codel-target=MS has workers shed the requests
+ * they take, following CoDel (codel.h), once requests waited longer than MS
+ * milliseconds for a whole --codel-interval (100 ms by default). Cached
+ * solutions are never shed.
+ *
+ * Searches stop early when nobody waits for them anymore: when the client
+ * disconnects, and with --timeout=MS once MS milliseconds passed since the
+ * request was first dispatched (waiting on a full request ring counts). A
+ * timed out request gets a STATUS_TIMEOUT reply, or "[id;]TIMEOUT depth" in
+ * the text protocol, with the depth the search reached: no solution is that
+ * short.
+ *
+ * --admin-port=PORT serves GET /metrics on 127.0.0.1:PORT, in the Prometheus
+ * text format (metrics.h): quantiles of the time requests spend queued,
+ * parsed, solved and written, and counters of requests, errors, refusals,
+ * timeouts, nodes expanded and cache hits. Every thread records into its own
+ * histograms; they are only merged when scraped.
+ *
+ * Built with -DSOLVE_STATS, the server also exports what the searches did
+ * (SolveStats): prunes by rule, pruning table lookups, and per IDA* depth the
+ * nodes generated and expanded and the time spent.
+ *
+ * --parallel=N splits every search across N threads (parallelsolve.cpp),
+ * which cuts the latency of deep cubes at the cost of throughput: a worker
+ * then keeps N CPUs busy. It pays off with few workers and many CPUs.
+ *
+ * The pruning table is mapped read-only from pruning_table.bin, so servers
+ * started from the same file share it through the page cache. Its pages are
+ * read on first use, or all at startup with --populate.
+ *
+ * The move and two-phase tables are mapped from table_bundle.bin, which
+ * buildtable writes next to pruning_table.bin, rather than built at startup
+ * (tablebundle.cpp). Without an up-to-date bundle, saved by a buildtable built
+ * from the same table sources (compile.sh), startup takes seconds longer.
  */
 
+#include <errno.h>
+#include <fcntl.h>
 #include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
 #include <semaphore.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "cache.h"
+#include "codel.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "queue.h"
+#include "uring.h"
+#include "rubik-optimal/src/anytimesolve.cpp"
 #include "rubik-optimal/src/hash.cpp"
+#include "rubik-optimal/src/parallelsolve.cpp"
+#include "rubik-optimal/src/twophase.cpp"
 #include "rubik-optimal/src/solve.cpp"
 
 #include "setdebug.h"
@@ -27,12 +138,48 @@
 // value read from /proc/sys/net/core/somaxconn
 const int MAX_CONNECTION_QUEUE = 128;
 const int MAX_PAYLOAD_SIZE = 100;
+// any solution fits in a text reply with its trailing \0, but an id comes on
+// top of it (see connection_add_reply)
+static_assert(3 * SolutionMaxLength + 1 <= MAX_PAYLOAD_SIZE,
+              "text replies must fit the longest solution");
+// payloads a connection may have in the server (being solved or waiting to be
+// sent back) before the server stops reading from it
+const int MAX_PIPELINE_DEPTH = 64;
+// fits many text payloads and binary frames
+const int IN_BUFFER_SIZE = 4096;
+// no cube takes more than 20 moves to solve, but two-phase solutions may
+// take more (see SolutionMaxLength)
+const int MAX_SOLUTION_LENGTH = SolutionMaxLength;
+// events handled per epoll_wait call
+const int MAX_EVENTS = 64;
+// seconds between two reports of the cache counters
+const int CACHE_REPORT_INTERVAL = 60;
+// requests waiting for a worker. Must be a power of two
+const int REQUEST_RING_CAPACITY = 1 << 12;
+// solved requests waiting for the event loop. Must be a power of two. Workers
+// spin when it is full, so it is larger than the request ring
+const int REPLY_RING_CAPACITY = 1 << 14;
+// io_uring submission queue entries, per shard
+const int URING_ENTRIES = 1024;
+// provided receive buffers, per shard. Must be a power of two
+const int URING_BUFFER_COUNT = 256;
+const int URING_BUFFER_GROUP = 0;
+// milliseconds, RFC 8289's recommendation
+const int DEFAULT_CODEL_INTERVAL = 100;
+// bytes of an admin request which are looked at
+const int ADMIN_REQUEST_SIZE = 1024;
 
 void error(const char* msg) {
   perror(msg);
   exit(1);
 }
 
+inline uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
 struct sockaddr_in preconnection_setup(int server_port) {
   struct sockaddr_in serv_addr;
 
@@ -44,186 +191,1780 @@ struct sockaddr_in preconnection_setup(int server_port) {
   return serv_addr;
 }
 
+void set_nonblocking(int sockfd) {
+  int flags = fcntl(sockfd, F_GETFL, 0);
+  if (flags < 0 || fcntl(sockfd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    error("ERROR setting socket non-blocking");
+  }
+}
+
 /**
- * The main thread produces client sockets to this queue.
- * Worker threads remove clients from the queue and process them
+ * A client connection. It is owned by the event loop thread: workers never
+ * touch its socket nor its buffers.
+ *
+ * Connections are persistent: a client may send many payloads, back to back,
+ * without waiting for the replies (pipelining).
  */
-struct queue_t {
+struct connection_t {
+  int clientsockfd;
+  /**
+   * Bytes received but not yet dispatched lie between `in_start` and `in_end`
+   */
+  char in_buffer[IN_BUFFER_SIZE];
+  int in_start;
+  int in_end;
+  /**
+   * Replies waiting to be sent. Bytes before `out_start` were already written.
+   * `out_count` replies were added since the buffer was last emptied
+   */
+  char out_buffer[MAX_PIPELINE_DEPTH * MAX_PAYLOAD_SIZE];
+  int out_start;
+  int out_end;
+  int out_count;
+  /**
+   * How many of this connection's cubes are with the workers
+   */
+  int in_flight;
+  /**
+   * Reading stopped because MAX_PIPELINE_DEPTH payloads are pending
+   */
+  bool read_paused;
   /**
-   * A lead node which does not represent a client. Its sucessors do.
+   * Reading stopped because the request ring was full. The connection is on
+   * the event loop's stalled list, linked through `next_stalled`
    */
-  struct queue_item_t* lead;
+  bool stalled;
+  struct connection_t* next_stalled;
   /**
-   * Just like a lead node, but for the end of the queue
+   * When the frame at `in_start` was refused by a full request ring, the
+   * `received_at` and `enqueued_at` of its first attempt, which its request
+   * keeps. 0 otherwise
    */
-  struct queue_item_t* lead_last;
-  sem_t length;
-  sem_t mutex;
+  uint64_t retry_received_at;
+  uint64_t retry_enqueued_at;
+  /**
+   * The ring which performs this connection's I/O, or NULL for epoll
+   */
+  struct uring_t* uring;
+  /**
+   * With io_uring: whether a receive or a send is under way, and how many
+   * operations still reference the connection
+   */
+  bool receiving;
+  bool sending;
+  int io_pending;
+  /**
+   * The client will not send anything else, but may still wait for replies
+   */
+  bool read_closed;
+  /**
+   * The socket is already closed, but the structure must live until the
+   * workers give every request back
+   */
+  bool closed;
+  /**
+   * Set along with `closed`, for the workers: the searches of this
+   * connection's cubes stop since nobody waits for their solution
+   */
+  std::atomic<bool> cancelled;
 };
 
-struct queue_item_t {
-  int clientsockfd;
-  struct queue_item_t* next;
-  struct queue_item_t* before;
+/**
+ * A parsed cube travelling from the event loop to a worker and, once
+ * solved, back to the event loop
+ */
+struct request_t {
+  struct connection_t* connection;
+  /**
+   * The reply uses the same protocol as the request
+   */
+  bool binary;
+  /**
+   * Echoed back in the reply when the client tagged its payload with an id
+   * (binary frames always are)
+   */
+  bool has_id;
+  uint32_t id;
+  /**
+   * A ReplyStatus
+   */
+  unsigned char status;
+  /**
+   * With STATUS_BUSY, milliseconds after which the client should try again
+   */
+  uint32_t retry_after;
+  /**
+   * With STATUS_TIMEOUT, no solution has this many moves or fewer
+   */
+  int searched_depth;
+  /**
+   * When the request's frame was complete, when it was parsed and went for
+   * the request ring and when its worker was done with it, see now_ns. A
+   * full ring does not reset the first two (see dispatch_request)
+   */
+  uint64_t received_at;
+  uint64_t enqueued_at;
+  uint64_t solved_at;
+  /**
+   * When the worker gives up on the search, see now_ns. 0 for never
+   */
+  uint64_t deadline;
+  /**
+   * A short solution is enough, see TwoPhaseSolver
+   */
+  bool fast;
+  /**
+   * An anytime request, with that many nanoseconds to look for a shorter
+   * solution, see AnytimeSolver
+   */
+  bool anytime;
+  uint64_t budget;
+  Permutation cube;
+  /**
+   * The solution, as CanonicalPermutationIndex values
+   */
+  unsigned char moves[MAX_SOLUTION_LENGTH];
+  int move_count;
+  /**
+   * Whether no solution is shorter
+   */
+  bool optimal;
+};
+
+/**
+ * Overload protection of a shard, shared by its event loop and its workers.
+ *
+ * The event loop refuses requests with STATUS_BUSY while `queue_limit`
+ * requests wait for a worker. Workers may also shed the requests they take,
+ * following `codel`, when requests wait too long: the queue stays short and
+ * the requests that are solved keep a bounded latency.
+ */
+struct admission_t {
+  /**
+   * 0 if the only limit is the capacity of the request ring, in which case
+   * the event loop stops reading instead of refusing
+   */
+  size_t queue_limit;
+  bool use_codel;
+  struct codel_t codel;
+  int worker_count;
+  /**
+   * Moving average of the time workers take per request, in nanoseconds.
+   * Only used to estimate a retry-after delay
+   */
+  std::atomic<uint64_t> service_time;
+};
+
+/**
+ * Milliseconds until the workers should have gone through the `queued`
+ * requests ahead
+ */
+uint32_t admission_retry_after(struct admission_t* admission, size_t queued) {
+  uint64_t wait = (queued + 1) *
+                  admission->service_time.load(std::memory_order_relaxed) /
+                  admission->worker_count;
+  return wait / 1000000 + 1;
+}
+
+/**
+ * State of the event loop thread, passed around by its functions.
+ *
+ * The event loop produces requests to `request_ring` and workers consume
+ * them. Workers produce solved requests to `reply_ring`, consumed by the event
+ * loop.
+ */
+struct event_loop_t {
+  int serversockfd;
+  struct ring_t* request_ring;
+  struct ring_t* reply_ring;
+  struct admission_t* admission;
+  /**
+   * Nanoseconds a request may take from its dispatch to its solution. 0 for
+   * no limit
+   */
+  uint64_t request_timeout;
+  int reply_eventfd;
+  /**
+   * Set by the first worker to push a reply since the event loop last
+   * drained `reply_ring`: only that worker writes to `reply_eventfd`
+   */
+  std::atomic<bool> reply_signaled;
+  /**
+   * With --io=uring, the loop's ring and its receive buffers. NULL for epoll
+   */
+  struct uring_t* uring;
+  struct uring_buffers_t* buffers;
+  /**
+   * Connections waiting for room in `request_ring`
+   */
+  struct connection_t* stalled;
+  /**
+   * The CPU the loop and its workers are pinned to, or -1
+   */
+  int cpu;
+  /**
+   * The loop thread's own metrics
+   */
+  struct metrics_t* metrics;
 };
 
 /**
  * Arguments for handle_client_worker function
  */
 struct worker_args {
-  struct queue_t* client_queue;
+  struct ring_t* request_ring;
+  struct ring_t* reply_ring;
+  struct admission_t* admission;
+  /**
+   * Written to after a push to `reply_ring`, so that the event loop wakes up
+   */
+  int reply_eventfd;
+  std::atomic<bool>* reply_signaled;
   PruningTable* pruning_table;
+  /**
+   * Shared by every worker of every shard. NULL if disabled
+   */
+  struct cache_t* cache;
+  /**
+   * Where each worker registers its metrics
+   */
+  struct metrics_registry_t* metrics;
+  /**
+   * Threads per search. 1 for a serial search
+   */
+  int search_threads;
 };
 
+#ifdef SOLVE_STATS
 /**
- * All worker threads need access to the client queue and
- * to the same pruning table (= 1 gigabyte)
+ * Adds up what a search did, see SolveStats
+ */
+void metrics_count_search(struct metrics_t* metrics,
+                          const SolveStats& stats) {
+  metrics_count(metrics, COUNTER_PRUNED_AXIS, stats.pruned_axis);
+  metrics_count(metrics, COUNTER_PRUNED_EXPONENT, stats.pruned_exponent);
+  metrics_count(metrics, COUNTER_PRUNED_SYMMETRY, stats.pruned_symmetry);
+  metrics_count(metrics, COUNTER_PRUNED_NEIGHBOUR_AXIS,
+                stats.pruned_neighbour_axis);
+  metrics_count(metrics, COUNTER_PRUNED_INVERSE, stats.pruned_inverse);
+  metrics_count(metrics, COUNTER_TABLE_LOOKUPS, stats.table_lookups);
+  for (int d = 0; d < SolveStatsDepths; d++) {
+    metrics_count_depth(metrics, DEPTH_GENERATED, d, stats.generated[d]);
+    metrics_count_depth(metrics, DEPTH_EXPANDED, d, stats.expanded[d]);
+    metrics_count_depth(metrics, DEPTH_TIME, d, stats.iteration_ns[d]);
+  }
+}
+#endif
+
+/**
+ * All worker threads need access to the request rings and
+ * to the same pruning table (= 1 gigabyte).
+ *
+ * Workers never do network I/O: they only solve cubes.
  */
 void* handle_client_worker(void* worker_args) {
-  struct queue_t* queue = ((struct worker_args*)worker_args)->client_queue;
-  PruningTable* table = ((struct worker_args*)worker_args)->pruning_table;
+  struct worker_args* args = (struct worker_args*)worker_args;
+  PruningTable* table = args->pruning_table;
 
+  struct admission_t* admission = args->admission;
+  struct metrics_t* metrics = metrics_register(args->metrics);
   auto solver = CubeSolver(table);
-
-  char* buffer = (char*)malloc(MAX_PAYLOAD_SIZE * sizeof(char));
+  TwoPhaseSolver two_phase_solver;
+  AnytimeSolver anytime_solver(table);
+  ParallelCubeSolver* parallel_solver =
+      args->search_threads > 1
+          ? new ParallelCubeSolver(table, args->search_threads)
+          : NULL;
+  uint64_t one = 1;
 
   while (true) {
-    // wait for a client to arrive on the queue, then remove it
-    sem_wait(&queue->length);
-    sem_wait(&queue->mutex);
-    struct queue_item_t* lead_last = queue->lead_last;
-    struct queue_item_t* oldlast = lead_last->before;
-    struct queue_item_t* newlast = oldlast->before;
-    newlast->next = lead_last;
-    lead_last->before = newlast;
-    sem_post(&queue->mutex);
-    int clientsockfd = oldlast->clientsockfd;
-    free(oldlast);
-
-    if (recv(clientsockfd, buffer, MAX_PAYLOAD_SIZE, MSG_WAITALL) < 0) {
-      error("ERROR in receive from socket");
-    }
-
-    printf("Server received %s\n", buffer);
-
-    // receive the cube. Take care with \0
-    string hash = "";
-    int count = 0;
-    while (true) {
-      if (buffer[count] == '\0') {
-        break;
+    struct request_t* request = (struct request_t*)ring_pop(args->request_ring);
+    uint64_t started_at = now_ns();
+    metrics_record(metrics, TIMER_QUEUE_WAIT,
+                   started_at - request->enqueued_at);
+
+    struct cache_key_t key;
+    bool cached = false;
+    if (args->cache != NULL) {
+      key = cache_canonical_key(args->cache, request->cube);
+      cached = cache_lookup(args->cache, key, request->moves,
+                            &request->move_count);
+    }
+
+    // cached solutions cost nothing: they are never shed
+    if (!cached && admission->use_codel &&
+        codel_should_drop(&admission->codel,
+                          started_at - request->enqueued_at, started_at,
+                          ring_size(args->request_ring))) {
+      request->status = STATUS_BUSY;
+      request->retry_after = admission_retry_after(
+          admission, ring_size(args->request_ring));
+      metrics_count(metrics, COUNTER_BUSY);
+    } else if (!cached) {
+      SolveLimits limits;
+      limits.deadline = request->deadline;
+      limits.cancelled = &request->connection->cancelled;
+      // not counting the cache lookup
+      uint64_t solve_started_at = args->cache != NULL ? now_ns() : started_at;
+      auto solution =
+          request->fast ? two_phase_solver.solve(request->cube, limits)
+          : request->anytime
+              ? anytime_solver.solve(request->cube, request->budget, limits)
+          : parallel_solver != NULL
+              ? parallel_solver->solve(request->cube, limits)
+              : solver.solve(request->cube, limits);
+      uint64_t solved_at = now_ns();
+      metrics_record(metrics, TIMER_SOLVE, solved_at - solve_started_at);
+      metrics_count(metrics, COUNTER_NODES, solution.nodes);
+#ifdef SOLVE_STATS
+      metrics_count_search(metrics, solution.stats);
+#endif
+      metrics_count(metrics,
+                    solution.status == Solved     ? COUNTER_SOLVED
+                    : solution.status == TimedOut ? COUNTER_TIMEOUTS
+                                                  : COUNTER_CANCELLED);
+
+      if (solution.status != Solved) {
+        // the reply of a cancelled request is dropped with its connection
+        request->status = STATUS_TIMEOUT;
+        request->searched_depth = solution.searched_depth;
+      } else {
+        // the event loop formats the moves for the request's protocol
+        memcpy(request->moves, solution.move_indexes, solution.length);
+        request->move_count = solution.length;
+        request->optimal = solution.optimal;
+        // the cache only holds optimal solutions
+        if (args->cache != NULL && solution.optimal) {
+          cache_insert(args->cache, key, request->moves, request->move_count);
+        }
       }
-      if (count == MAX_PAYLOAD_SIZE) {
-        error("ERROR did not receive \\0 terminator");
+
+      // racy, but a lost update only makes the estimate a bit older
+      int64_t average =
+          admission->service_time.load(std::memory_order_relaxed);
+      int64_t elapsed = solved_at - started_at;
+      admission->service_time.store(average + (elapsed - average) / 8,
+                                    std::memory_order_relaxed);
+    }
+
+    request->solved_at = now_ns();
+    ring_push(args->reply_ring, request);
+    // the event loop is already awake if another reply woke it up and it did
+    // not drain the ring since
+    if (!args->reply_signaled->exchange(true) &&
+        write(args->reply_eventfd, &one, sizeof(one)) < 0) {
+      error("ERROR writing to eventfd");
+    }
+  }
+}
+
+struct connection_t* connection_create(int clientsockfd,
+                                      struct uring_t* uring) {
+  struct connection_t* connection =
+      (struct connection_t*)malloc(sizeof(struct connection_t));
+  connection->clientsockfd = clientsockfd;
+  connection->in_start = 0;
+  connection->in_end = 0;
+  connection->out_start = 0;
+  connection->out_end = 0;
+  connection->out_count = 0;
+  connection->in_flight = 0;
+  connection->read_paused = false;
+  connection->stalled = false;
+  connection->next_stalled = NULL;
+  connection->retry_received_at = 0;
+  connection->retry_enqueued_at = 0;
+  connection->uring = uring;
+  connection->receiving = false;
+  connection->sending = false;
+  connection->io_pending = 0;
+  connection->read_closed = false;
+  connection->closed = false;
+  connection->cancelled.store(false, std::memory_order_relaxed);
+  return connection;
+}
+
+struct connection_t* connection_open(int epollfd, int clientsockfd) {
+  struct connection_t* connection = connection_create(clientsockfd, NULL);
+
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+  event.data.ptr = connection;
+  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, clientsockfd, &event) < 0) {
+    error("ERROR adding client to epoll");
+  }
+  return connection;
+}
+
+/**
+ * Frees a closed connection once nothing points to it anymore: neither a
+ * request held by the workers, nor the stalled list, nor an io_uring
+ * operation
+ */
+void connection_release(struct connection_t* connection) {
+  if (connection->closed && connection->in_flight == 0 &&
+      !connection->stalled && connection->io_pending == 0) {
+    free(connection);
+  }
+}
+
+/**
+ * Tags io_uring operations: the low bits of their user_data. The rest is
+ * the connection the operation belongs to, if any
+ */
+enum UringOperation {
+  URING_ACCEPT = 0,
+  URING_REPLIES_READY = 1,
+  URING_RECEIVE = 2,
+  URING_SEND = 3,
+  URING_CLOSE = 4
+};
+const uint64_t URING_OPERATION_MASK = 7;
+
+inline void uring_set_data(struct io_uring_sqe* sqe,
+                           struct connection_t* connection,
+                           enum UringOperation operation) {
+  sqe->user_data = (uint64_t)connection | operation;
+}
+
+/**
+ * Closing the socket also removes it from the epoll set. With io_uring, a
+ * receive or send still waiting on the socket would keep it open, so the
+ * socket is shut down first to complete them
+ */
+void connection_close(struct connection_t* connection) {
+  if (!connection->closed) {
+    connection->closed = true;
+    connection->cancelled.store(true, std::memory_order_relaxed);
+    if (connection->uring == NULL) {
+      close(connection->clientsockfd);
+    } else {
+      if (connection->receiving || connection->sending) {
+        shutdown(connection->clientsockfd, SHUT_RDWR);
       }
-      hash = hash + buffer[count];
+      struct io_uring_sqe* sqe = uring_get_sqe(connection->uring);
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->fd = connection->clientsockfd;
+      uring_set_data(sqe, connection, URING_CLOSE);
+      connection->io_pending++;
+    }
+  }
+  connection_release(connection);
+}
+
+/**
+ * Replies being solved or waiting to be written both count towards
+ * MAX_PIPELINE_DEPTH
+ */
+inline int connection_pending(struct connection_t* connection) {
+  return connection->in_flight + connection->out_count;
+}
+
+/**
+ * Closes the connection if the client stopped sending and got every reply.
+ *
+ * Returns false if the connection was closed
+ */
+bool connection_check_finished(struct connection_t* connection) {
+  if (connection->read_closed && connection->in_flight == 0 &&
+      connection->out_start == connection->out_end) {
+    connection_close(connection);
+    return false;
+  }
+  return true;
+}
+
+struct request_t* request_create(struct connection_t* connection,
+                                 bool binary) {
+  struct request_t* request =
+      (struct request_t*)malloc(sizeof(struct request_t));
+  request->connection = connection;
+  request->binary = binary;
+  request->has_id = binary;
+  request->id = 0;
+  request->status = STATUS_SOLVED;
+  request->retry_after = 0;
+  request->searched_depth = 0;
+  request->fast = false;
+  request->anytime = false;
+  request->budget = 0;
+  request->move_count = 0;
+  request->optimal = true;
+  request->received_at = connection->retry_received_at != 0
+                             ? connection->retry_received_at
+                             : now_ns();
+  return request;
+}
+
+void connection_add_reply(struct connection_t* connection,
+                          struct request_t* request);
+
+enum DispatchResult {
+  DISPATCHED,
+  // the frame stays in the input buffer, to be dispatched again later
+  DISPATCH_RING_FULL,
+  DISPATCH_MALFORMED
+};
+
+/**
+ * Counts a request once it was pushed or refused, with the parse time of its
+ * first attempt
+ */
+void metrics_count_request(struct metrics_t* metrics,
+                           struct request_t* request) {
+  metrics_count(metrics, COUNTER_REQUESTS);
+  metrics_record(metrics, TIMER_PARSE,
+                 request->enqueued_at - request->received_at);
+}
+
+/**
+ * Hands a request to the workers, counting it against its connection's
+ * pipeline. Past the queue limit the request is refused right away. Never
+ * blocks: the request is freed if the ring is full, and the frame parsed
+ * again later keeps the times of this attempt, so that the stall counts
+ * towards its queue wait and its deadline
+ */
+enum DispatchResult dispatch_request(struct event_loop_t* loop,
+                                     struct request_t* request) {
+  struct connection_t* connection = request->connection;
+  request->enqueued_at = connection->retry_enqueued_at != 0
+                             ? connection->retry_enqueued_at
+                             : now_ns();
+
+  size_t queued = ring_size(loop->request_ring);
+  if (loop->admission->queue_limit > 0 &&
+      queued >= loop->admission->queue_limit) {
+    request->status = STATUS_BUSY;
+    request->retry_after = admission_retry_after(loop->admission, queued);
+    metrics_count_request(loop->metrics, request);
+    metrics_count(loop->metrics, COUNTER_BUSY);
+    connection_add_reply(connection, request);
+    free(request);
+    return DISPATCHED;
+  }
+
+  request->deadline = loop->request_timeout > 0
+                          ? request->enqueued_at + loop->request_timeout
+                          : 0;
+  if (!ring_try_push(loop->request_ring, request)) {
+    connection->retry_received_at = request->received_at;
+    connection->retry_enqueued_at = request->enqueued_at;
+    free(request);
+    return DISPATCH_RING_FULL;
+  }
+  metrics_count_request(loop->metrics, request);
+  connection->in_flight++;
+  return DISPATCHED;
+}
+
+/**
+ * Parses a complete text payload and hands it to the workers. A payload is
+ * either a bare hash or "id;hash", in which case the reply is tagged with
+ * the same id: replies may come back out of order. The hash may be preceded
+ * by "fast;" for a short rather than an optimal solution, or by
+ * "anytime=MS;" for the shortest one found within MS milliseconds.
+ *
+ * Returns DISPATCH_MALFORMED if the payload is malformed, which includes
+ * hashes of cubes that could not have been scrambled by face moves
+ */
+enum DispatchResult dispatch_text_payload(struct connection_t* connection,
+                                          char* buffer,
+                                          struct event_loop_t* loop) {
+  printf("Server received %s\n", buffer);
+
+  struct request_t* request = request_create(connection, false);
+
+  int count = 0;
+  if (buffer[0] >= '0' && buffer[0] <= '9') {
+    while (count < MAX_PAYLOAD_SIZE && buffer[count] >= '0' &&
+           buffer[count] <= '9') {
+      request->id = 10 * request->id + (buffer[count] - '0');
+      count++;
+    }
+    if (count == MAX_PAYLOAD_SIZE || buffer[count] != ';') {
+      free(request);
+      return DISPATCH_MALFORMED;
+    }
+    request->has_id = true;
+    count++;
+  }
+  if (count + 5 <= MAX_PAYLOAD_SIZE &&
+      strncmp(buffer + count, "fast;", 5) == 0) {
+    request->fast = true;
+    count += 5;
+  } else if (count + 8 <= MAX_PAYLOAD_SIZE &&
+             strncmp(buffer + count, "anytime=", 8) == 0) {
+    count += 8;
+    uint64_t budget_ms = 0;
+    while (count < MAX_PAYLOAD_SIZE && buffer[count] >= '0' &&
+           buffer[count] <= '9') {
+      budget_ms = 10 * budget_ms + (buffer[count] - '0');
       count++;
     }
+    if (count == MAX_PAYLOAD_SIZE || buffer[count] != ';' ||
+        budget_ms > UINT32_MAX) {
+      free(request);
+      return DISPATCH_MALFORMED;
+    }
+    request->anytime = true;
+    request->budget = budget_ms * 1000000;
+    count++;
+  }
 
-    // solve the received cube
-    auto scrambled_cube = Hash2Permutation(hash);
-    auto solution = solver.solve(scrambled_cube);
+  // receive the cube. Take care with \0
+  const char* hash = buffer + count;
+  const char* end = (const char*)memchr(hash, '\0', MAX_PAYLOAD_SIZE - count);
+  if (end == NULL ||
+      !Facelets2Permutation(hash, end - hash, &request->cube) ||
+      !Permutation::is_solvable(request->cube)) {
+    // no \0 terminator, or not a cube the solver could ever finish
+    free(request);
+    return DISPATCH_MALFORMED;
+  }
+  return dispatch_request(loop, request);
+}
 
-    // write the moves found for solution of the cube
-    for (int i = 0; i < solution.move_names.length(); i++) {
-      buffer[i] = solution.move_names[i];
+/**
+ * Decodes the body of a binary frame. Cubes which could not have been
+ * scrambled by face moves are refused (the solver would never finish)
+ */
+bool read_binary_cube(struct v2_header_t header,
+                      const unsigned char* body,
+                      Permutation* cube) {
+  if (header.kind_or_status == CUBE_KIND_CUBIES &&
+      header.body_length == PROTOCOL_V2_CUBIES_SIZE) {
+    if (!v2_read_cubies(body, cube)) {
+      return false;
+    }
+  } else if (header.kind_or_status == CUBE_KIND_COORDINATES &&
+             header.body_length == PROTOCOL_V2_COORDINATES_SIZE) {
+    int corner_permutation = body[0] | (body[1] << 8);
+    int corner_orientation = body[2] | (body[3] << 8);
+    int edge_permutation =
+        body[4] | (body[5] << 8) | (body[6] << 16) | (body[7] << 24);
+    int edge_orientation = body[8] | (body[9] << 8);
+    if (corner_permutation >= CornerPermutationCoordinateLength ||
+        corner_orientation >= CornerOrientationCoordinateLength ||
+        edge_permutation < 0 ||
+        edge_permutation >= EdgePermutationCoordinateLength ||
+        edge_orientation >= EdgeOrientationCoordinateLength) {
+      return false;
+    }
+    Permutation corners = CornerPermutationCoordinateInverse(corner_permutation);
+    Permutation twists = CornerOrientationCoordinateInverse(corner_orientation);
+    Permutation edges = EdgePermutationCoordinateInverse(edge_permutation);
+    Permutation flips = EdgeOrientationCoordinateInverse(edge_orientation);
+    for (int i = 0; i < CornerCubieLength; i++) {
+      cube->corners[i].replaced_by = corners.corners[i].replaced_by;
+      cube->corners[i].orientation = twists.corners[i].orientation;
     }
-    buffer[solution.move_names.length()] = '\0';
+    for (int i = 0; i < EdgeCubieLength; i++) {
+      cube->edges[i].replaced_by = edges.edges[i].replaced_by;
+      cube->edges[i].orientation = flips.edges[i].orientation;
+    }
+  } else {
+    return false;
+  }
+  return Permutation::is_solvable(*cube);
+}
+
+/**
+ * Hands the cube of a complete binary frame to the workers. Malformed
+ * frames are answered right away
+ */
+enum DispatchResult dispatch_binary_frame(struct connection_t* connection,
+                                          const unsigned char* frame,
+                                          struct event_loop_t* loop) {
+  struct v2_header_t header = v2_read_header(frame);
+  struct request_t* request = request_create(connection, true);
+  request->id = header.request_id;
+  request->fast = (header.flags & PROTOCOL_FLAG_FAST) != 0;
+  // the budget follows the cube. PROTOCOL_FLAG_FAST wins over it
+  if ((header.flags & PROTOCOL_FLAG_ANYTIME) != 0 &&
+      header.body_length >= PROTOCOL_V2_BUDGET_SIZE) {
+    header.body_length -= PROTOCOL_V2_BUDGET_SIZE;
+    request->anytime = !request->fast;
+    request->budget =
+        (uint64_t)v2_read_uint32(frame + PROTOCOL_V2_HEADER_SIZE +
+                                 header.body_length) *
+        1000000;
+  }
 
-    if (write(clientsockfd, buffer, MAX_PAYLOAD_SIZE) < 0) {
-      error("ERROR writing to socket");
+  if (!read_binary_cube(header, frame + PROTOCOL_V2_HEADER_SIZE,
+                        &request->cube)) {
+    request->status = STATUS_MALFORMED;
+    metrics_count(loop->metrics, COUNTER_MALFORMED);
+    connection_add_reply(connection, request);
+    free(request);
+    return DISPATCHED;
+  }
+
+  return dispatch_request(loop, request);
+}
+
+/**
+ * Stops reading from a connection until the request ring has room again
+ */
+void connection_stall(struct connection_t* connection,
+                      struct event_loop_t* loop) {
+  connection->read_paused = true;
+  if (!connection->stalled) {
+    connection->stalled = true;
+    connection->next_stalled = loop->stalled;
+    loop->stalled = connection;
+  }
+}
+
+/**
+ * Dispatches every complete frame in the input buffer, stopping early if
+ * MAX_PIPELINE_DEPTH replies are pending or if the request ring is full.
+ *
+ * Returns false if a malformed text payload was found (text payloads carry no
+ * length, so the stream cannot be followed after one)
+ */
+bool dispatch_frames(struct connection_t* connection,
+                     struct event_loop_t* loop) {
+  while (connection->in_start < connection->in_end) {
+    if (connection_pending(connection) >= MAX_PIPELINE_DEPTH) {
+      connection->read_paused = true;
+      return true;
     }
+    char* frame = connection->in_buffer + connection->in_start;
+    int available = connection->in_end - connection->in_start;
+    int size;
+    enum DispatchResult result;
+    if ((unsigned char)frame[0] == PROTOCOL_V2_MAGIC) {
+      if (available < PROTOCOL_V2_HEADER_SIZE) {
+        break;
+      }
+      size = PROTOCOL_V2_HEADER_SIZE +
+             v2_read_header((unsigned char*)frame).body_length;
+      if (available < size) {
+        break;
+      }
+      result = dispatch_binary_frame(connection, (unsigned char*)frame, loop);
+    } else {
+      size = MAX_PAYLOAD_SIZE;
+      if (available < size) {
+        break;
+      }
+      result = dispatch_text_payload(connection, frame, loop);
+    }
+    if (result == DISPATCH_MALFORMED) {
+      metrics_count(loop->metrics, COUNTER_MALFORMED);
+      return false;
+    }
+    if (result == DISPATCH_RING_FULL) {
+      connection_stall(connection, loop);
+      return true;
+    }
+    connection->in_start += size;
+    connection->retry_received_at = 0;
+    connection->retry_enqueued_at = 0;
+  }
+  return true;
+}
 
-    close(clientsockfd);
+/**
+ * io_uring counterpart of connection_read: dispatches the frames received so
+ * far and, unless reading is paused, asks for more. They arrive in one of
+ * the loop's provided buffers, see uring_complete_receive.
+ *
+ * Returns false if the connection was closed
+ */
+bool uring_connection_read(struct connection_t* connection,
+                           struct event_loop_t* loop) {
+  connection->read_paused = false;
+  if (!dispatch_frames(connection, loop)) {
+    connection_close(connection);
+    return false;
+  }
+  if (connection->read_paused) {
+    return true;
+  }
+  if (connection->read_closed) {
+    // the client may still be waiting for replies, as long as it did not
+    // stop in the middle of a frame
+    if (connection->in_start != connection->in_end) {
+      connection_close(connection);
+      return false;
+    }
+    return connection_check_finished(connection);
+  }
+  if (connection->receiving) {
+    return true;
   }
+
+  // only an incomplete frame is left: move it to the start of the buffer
+  memmove(connection->in_buffer, connection->in_buffer + connection->in_start,
+          connection->in_end - connection->in_start);
+  connection->in_end -= connection->in_start;
+  connection->in_start = 0;
+
+  struct io_uring_sqe* sqe = uring_get_sqe(loop->uring);
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = connection->clientsockfd;
+  // never more than what fits in `in_buffer`
+  sqe->len = IN_BUFFER_SIZE - connection->in_end;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BUFFER_GROUP;
+  uring_set_data(sqe, connection, URING_RECEIVE);
+  connection->receiving = true;
+  connection->io_pending++;
+  return true;
 }
 
-void start_server(int server_port, int worker_count) {
-  struct sockaddr_in serv_addr;
-  int serversockfd;
-  int clientsockfd;
-  serv_addr = preconnection_setup(server_port);
+/**
+ * Reads whatever the socket has available, dispatching every frame that
+ * is complete. Reading pauses while MAX_PIPELINE_DEPTH replies are pending
+ * or while the request ring is full; it is resumed by whoever brings that
+ * count down, or by resume_stalled.
+ *
+ * Returns false if the connection was closed
+ */
+bool epoll_connection_read(struct connection_t* connection,
+                           struct event_loop_t* loop) {
+  connection->read_paused = false;
+  while (true) {
+    if (!dispatch_frames(connection, loop)) {
+      connection_close(connection);
+      return false;
+    }
+    if (connection->read_paused) {
+      return true;
+    }
+    if (connection->read_closed) {
+      // the client may still be waiting for replies, as long as it did not
+      // stop in the middle of a frame
+      if (connection->in_start != connection->in_end) {
+        connection_close(connection);
+        return false;
+      }
+      return connection_check_finished(connection);
+    }
+
+    // only an incomplete frame is left: move it to the start of the buffer
+    memmove(connection->in_buffer,
+            connection->in_buffer + connection->in_start,
+            connection->in_end - connection->in_start);
+    connection->in_end -= connection->in_start;
+    connection->in_start = 0;
+
+    ssize_t received = recv(connection->clientsockfd,
+                            connection->in_buffer + connection->in_end,
+                            IN_BUFFER_SIZE - connection->in_end, 0);
+    if (received < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return true;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      connection_close(connection);
+      return false;
+    }
+    if (received == 0) {
+      connection->read_closed = true;
+      continue;
+    }
+    connection->in_end += received;
+  }
+}
+
+/**
+ * io_uring counterpart of connection_write: sends the pending replies, unless
+ * a send is already under way (uring_complete_send continues it).
+ *
+ * Returns false if the connection was closed
+ */
+bool uring_connection_write(struct connection_t* connection) {
+  if (connection->sending) {
+    return true;
+  }
+  if (connection->out_start == connection->out_end) {
+    connection->out_start = 0;
+    connection->out_end = 0;
+    connection->out_count = 0;
+    return connection_check_finished(connection);
+  }
+  // replies added meanwhile go after `out_end`, which the send does not cover
+  struct io_uring_sqe* sqe = uring_get_sqe(connection->uring);
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = connection->clientsockfd;
+  sqe->addr = (uint64_t)(connection->out_buffer + connection->out_start);
+  sqe->len = connection->out_end - connection->out_start;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  uring_set_data(sqe, connection, URING_SEND);
+  connection->sending = true;
+  connection->io_pending++;
+  return true;
+}
+
+/**
+ * Writes as many of the pending replies as the socket accepts.
+ *
+ * Returns false if the connection was closed
+ */
+bool connection_write(struct connection_t* connection) {
+  if (connection->uring != NULL) {
+    return uring_connection_write(connection);
+  }
+  while (connection->out_start < connection->out_end) {
+    ssize_t written = send(connection->clientsockfd,
+                           connection->out_buffer + connection->out_start,
+                           connection->out_end - connection->out_start,
+                           MSG_NOSIGNAL);
+    if (written < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // EPOLLOUT will tell when the socket drains
+        return true;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      connection_close(connection);
+      return false;
+    }
+    connection->out_start += written;
+  }
+  connection->out_start = 0;
+  connection->out_end = 0;
+  connection->out_count = 0;
+  return connection_check_finished(connection);
+}
+
+/**
+ * Reads from the connection with the loop's backend, then sends the replies
+ * given without a worker (to malformed or refused frames) right away.
+ *
+ * Returns false if the connection was closed
+ */
+bool connection_read(struct connection_t* connection,
+                     struct event_loop_t* loop) {
+  bool open = connection->uring != NULL
+                  ? uring_connection_read(connection, loop)
+                  : epoll_connection_read(connection, loop);
+  if (open && connection->out_start < connection->out_end) {
+    return connection_write(connection);
+  }
+  return open;
+}
+
+/**
+ * Appends the reply of a request to its connection, in the request's
+ * protocol. Never overflows: the request was counted by connection_pending
+ * while it was being solved
+ */
+void connection_add_reply(struct connection_t* connection,
+                          struct request_t* request) {
+  if (connection->out_end + MAX_PAYLOAD_SIZE >
+      MAX_PIPELINE_DEPTH * MAX_PAYLOAD_SIZE) {
+    // only already written bytes lie before out_start
+    memmove(connection->out_buffer,
+            connection->out_buffer + connection->out_start,
+            connection->out_end - connection->out_start);
+    connection->out_end -= connection->out_start;
+    connection->out_start = 0;
+  }
+  char* frame = connection->out_buffer + connection->out_end;
+  connection->out_count++;
+
+  if (request->binary) {
+    struct v2_header_t header;
+    header.kind_or_status = request->status;
+    header.flags = request->status == STATUS_SOLVED && !request->optimal
+                       ? REPLY_FLAG_UNPROVEN
+                       : 0;
+    header.body_length = request->move_count;
+    header.request_id = request->id;
+    if (request->status == STATUS_BUSY) {
+      header.body_length = PROTOCOL_V2_BUSY_SIZE;
+      v2_write_uint32((unsigned char*)frame + PROTOCOL_V2_HEADER_SIZE,
+                      request->retry_after);
+    } else if (request->status == STATUS_TIMEOUT) {
+      header.body_length = PROTOCOL_V2_TIMEOUT_SIZE;
+      frame[PROTOCOL_V2_HEADER_SIZE] = request->searched_depth;
+    } else {
+      memcpy(frame + PROTOCOL_V2_HEADER_SIZE, request->moves,
+             request->move_count);
+    }
+    v2_write_header((unsigned char*)frame, header);
+    connection->out_end += PROTOCOL_V2_HEADER_SIZE + header.body_length;
+    return;
+  }
+
+  bzero(frame, MAX_PAYLOAD_SIZE);
+  int offset = 0;
+  if (request->has_id) {
+    offset = snprintf(frame, MAX_PAYLOAD_SIZE, "%u;", request->id);
+  }
+  if (request->status == STATUS_BUSY) {
+    snprintf(frame + offset, MAX_PAYLOAD_SIZE - offset, "BUSY %u",
+             request->retry_after);
+    connection->out_end += MAX_PAYLOAD_SIZE;
+    return;
+  }
+  if (request->status == STATUS_TIMEOUT) {
+    snprintf(frame + offset, MAX_PAYLOAD_SIZE - offset, "TIMEOUT %d",
+             request->searched_depth);
+    connection->out_end += MAX_PAYLOAD_SIZE;
+    return;
+  }
+  // keeps a \0 at the end of the payload
+  if (FormatMoveNames(request->moves, request->move_count, frame + offset,
+                      MAX_PAYLOAD_SIZE - offset - 1) < 0) {
+    // only a long id and a long two-phase solution together do not fit: the
+    // text protocol has no better way to say that no solution can be sent
+    bzero(frame + offset, MAX_PAYLOAD_SIZE - offset);
+    snprintf(frame + offset, MAX_PAYLOAD_SIZE - offset, "TIMEOUT 0");
+  }
+  connection->out_end += MAX_PAYLOAD_SIZE;
+}
+
+/**
+ * Moves solutions given back by the workers into their connections
+ */
+void drain_replies(struct event_loop_t* loop) {
+  // workers pushing from now on must wake the loop up again
+  loop->reply_signaled.exchange(false, std::memory_order_acq_rel);
+  uint64_t ignored;
+  if (read(loop->reply_eventfd, &ignored, sizeof(ignored)) < 0 &&
+      errno != EAGAIN) {
+    error("ERROR reading from eventfd");
+  }
+
+  struct request_t* request;
+  while ((request = (struct request_t*)ring_try_pop(loop->reply_ring)) !=
+         NULL) {
+    struct connection_t* connection = request->connection;
+    connection->in_flight--;
+    if (connection->closed) {
+      // the client left while its cube was being solved
+      connection_release(connection);
+    } else {
+      connection_add_reply(connection, request);
+      bool open = connection_write(connection);
+      metrics_record(loop->metrics, TIMER_WRITE, now_ns() - request->solved_at);
+      // edge-triggered: bytes left in the socket while reading was paused
+      // will not raise another event
+      if (open && connection->read_paused && !connection->stalled) {
+        connection_read(connection, loop);
+      }
+    }
+    free(request);
+  }
+}
 
-  serversockfd = socket(AF_INET, SOCK_STREAM, 0);
+/**
+ * Reads again from the connections which found the request ring full. They
+ * stall again if it still is
+ */
+void resume_stalled(struct event_loop_t* loop) {
+  struct connection_t* connection = loop->stalled;
+  loop->stalled = NULL;
+  while (connection != NULL) {
+    struct connection_t* next = connection->next_stalled;
+    connection->stalled = false;
+    connection->next_stalled = NULL;
+    if (connection->closed) {
+      connection_release(connection);
+    } else {
+      connection_read(connection, loop);
+    }
+    connection = next;
+  }
+}
+
+/**
+ * Opens a non-blocking listening socket. With `reuse_port`, several sockets
+ * may listen on the same port and the kernel spreads new connections among
+ * them
+ */
+int open_listening_socket(int server_port, bool reuse_port) {
+  struct sockaddr_in serv_addr = preconnection_setup(server_port);
+
+  int serversockfd = socket(AF_INET, SOCK_STREAM, 0);
   if (serversockfd < 0) {
     error("ERROR opening socket");
   }
 
+  int enable = 1;
+  if (reuse_port && setsockopt(serversockfd, SOL_SOCKET, SO_REUSEPORT, &enable,
+                               sizeof(enable)) < 0) {
+    error("ERROR setting SO_REUSEPORT");
+  }
+
   if (bind(serversockfd, (struct sockaddr*)&serv_addr, sizeof(serv_addr)) < 0) {
     error("ERROR on binding");
   }
 
   listen(serversockfd, MAX_CONNECTION_QUEUE);
+  set_nonblocking(serversockfd);
+  return serversockfd;
+}
+
+/**
+ * Pins the calling thread to `cpu`, unless it is negative
+ */
+void pin_to_cpu(int cpu) {
+  if (cpu < 0) {
+    return;
+  }
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(cpu, &cpus);
+  if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+    fprintf(stderr, "WARNING could not pin thread to CPU %d\n", cpu);
+  }
+}
+
+/**
+ * A listening socket with its own event loop thread, rings and workers.
+ * Shards share nothing but the pruning table
+ */
+struct shard_t {
+  struct event_loop_t loop;
+  struct ring_t request_ring;
+  struct ring_t reply_ring;
+  struct worker_args args;
+  struct admission_t admission;
+  int worker_count;
+  pthread_t event_loop_thread;
+  pthread_t* workers;
+};
+
+void* run_worker(void* shard_arg) {
+  struct shard_t* shard = (struct shard_t*)shard_arg;
+  pin_to_cpu(shard->loop.cpu);
+  return handle_client_worker(&shard->args);
+}
+
+/**
+ * Accepts the shard's clients and moves their payloads to and from the
+ * shard's workers
+ */
+void* run_event_loop(void* shard_arg) {
+  struct shard_t* shard = (struct shard_t*)shard_arg;
+  struct event_loop_t* loop = &shard->loop;
+  pin_to_cpu(loop->cpu);
+
+  int epollfd = epoll_create1(0);
+  if (epollfd < 0) {
+    error("ERROR creating epoll");
+  }
+
+  // the listening socket and the eventfd are told apart from clients by a
+  // NULL pointer and by their own address, respectively
+  struct epoll_event event;
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = NULL;
+  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, loop->serversockfd, &event) < 0) {
+    error("ERROR adding server socket to epoll");
+  }
+  event.events = EPOLLIN | EPOLLET;
+  event.data.ptr = &loop->reply_eventfd;
+  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, loop->reply_eventfd, &event) < 0) {
+    error("ERROR adding eventfd to epoll");
+  }
+
+  struct epoll_event events[MAX_EVENTS];
+  bool replies_ready;
+  int clientsockfd;
+  while (true) {
+    int ready = epoll_wait(epollfd, events, MAX_EVENTS, -1);
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      error("ERROR on epoll_wait");
+    }
+
+    replies_ready = false;
+    for (int i = 0; i < ready; i++) {
+      if (events[i].data.ptr == NULL) {
+        // accept every pending client (edge-triggered)
+        while (true) {
+          clientsockfd =
+              accept4(loop->serversockfd, NULL, 0, SOCK_NONBLOCK);
+          if (clientsockfd < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+              break;
+            }
+            if (errno == EINTR || errno == ECONNABORTED) {
+              continue;
+            }
+            error("ERROR on accept");
+          }
+          printf("Client connected\n");
+          struct connection_t* connection =
+              connection_open(epollfd, clientsockfd);
+          // data may have arrived before the socket joined the epoll set
+          connection_read(connection, loop);
+        }
+        continue;
+      }
+
+      if (events[i].data.ptr == &loop->reply_eventfd) {
+        replies_ready = true;
+        continue;
+      }
+
+      struct connection_t* connection =
+          (struct connection_t*)events[i].data.ptr;
+      if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+        if (!connection_read(connection, loop)) {
+          continue;
+        }
+      }
+      if (events[i].events & EPOLLOUT) {
+        if (connection_write(connection) && connection->read_paused &&
+            !connection->stalled) {
+          connection_read(connection, loop);
+        }
+      }
+    }
+
+    // only after the batch: delivering a reply may free a connection which
+    // still has an event waiting in `events`
+    if (replies_ready) {
+      drain_replies(loop);
+      resume_stalled(loop);
+    }
+  }
+
+  // will never be reached
+  close(epollfd);
+  return NULL;
+}
+
+void uring_accept(struct event_loop_t* loop) {
+  struct io_uring_sqe* sqe = uring_get_sqe(loop->uring);
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = loop->serversockfd;
+  // one submission accepts every client until it fails
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  uring_set_data(sqe, NULL, URING_ACCEPT);
+}
+
+void uring_poll_replies(struct event_loop_t* loop) {
+  struct io_uring_sqe* sqe = uring_get_sqe(loop->uring);
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = loop->reply_eventfd;
+  sqe->poll32_events = POLLIN;
+  // one completion per write to the eventfd
+  sqe->len = IORING_POLL_ADD_MULTI;
+  uring_set_data(sqe, NULL, URING_REPLIES_READY);
+}
+
+/**
+ * Moves the received bytes out of the provided buffer, which goes back to
+ * the kernel right away, and dispatches them
+ */
+void uring_complete_receive(struct event_loop_t* loop,
+                            struct connection_t* connection,
+                            struct io_uring_cqe* cqe) {
+  connection->receiving = false;
+  connection->io_pending--;
+  if (cqe->flags & IORING_CQE_F_BUFFER) {
+    unsigned id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    if (cqe->res > 0 && !connection->closed) {
+      memcpy(connection->in_buffer + connection->in_end,
+             uring_buffer(loop->buffers, id), cqe->res);
+      connection->in_end += cqe->res;
+    }
+    uring_buffer_recycle(loop->buffers, id);
+  }
+  if (connection->closed) {
+    connection_release(connection);
+    return;
+  }
+  if (cqe->res == 0) {
+    connection->read_closed = true;
+  } else if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EINTR) {
+    // -ENOBUFS: every provided buffer was in use. Just try again
+    connection_close(connection);
+    return;
+  }
+  connection_read(connection, loop);
+}
+
+void uring_complete_send(struct event_loop_t* loop,
+                         struct connection_t* connection,
+                         struct io_uring_cqe* cqe) {
+  connection->sending = false;
+  connection->io_pending--;
+  if (connection->closed) {
+    connection_release(connection);
+    return;
+  }
+  if (cqe->res < 0 && cqe->res != -EINTR) {
+    connection_close(connection);
+    return;
+  }
+  if (cqe->res > 0) {
+    connection->out_start += cqe->res;
+  }
+  if (uring_connection_write(connection) && connection->read_paused &&
+      !connection->stalled) {
+    connection_read(connection, loop);
+  }
+}
+
+/**
+ * Same as run_event_loop, with io_uring instead of epoll: accepts, receives,
+ * sends and closes are all submitted to the shard's ring, in one
+ * io_uring_enter call per batch of completions
+ */
+void* run_uring_event_loop(void* shard_arg) {
+  struct shard_t* shard = (struct shard_t*)shard_arg;
+  struct event_loop_t* loop = &shard->loop;
+  pin_to_cpu(loop->cpu);
+
+  struct uring_t uring;
+  struct uring_buffers_t buffers;
+  if (!uring_init(&uring, URING_ENTRIES)) {
+    error("ERROR setting up io_uring");
+  }
+  if (!uring_buffers_init(&uring, &buffers, URING_BUFFER_GROUP,
+                          URING_BUFFER_COUNT, IN_BUFFER_SIZE)) {
+    error("ERROR registering io_uring buffers");
+  }
+  loop->uring = &uring;
+  loop->buffers = &buffers;
+
+  uring_accept(loop);
+  uring_poll_replies(loop);
+
+  bool replies_ready;
+  while (true) {
+    uring_submit_and_wait(&uring, 1);
+
+    replies_ready = false;
+    struct io_uring_cqe* cqe;
+    while ((cqe = uring_peek_cqe(&uring)) != NULL) {
+      struct connection_t* connection =
+          (struct connection_t*)(cqe->user_data & ~URING_OPERATION_MASK);
+      switch (cqe->user_data & URING_OPERATION_MASK) {
+        case URING_ACCEPT:
+          if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            uring_accept(loop);
+          }
+          if (cqe->res >= 0) {
+            printf("Client connected\n");
+            connection_read(connection_create(cqe->res, &uring), loop);
+          } else if (cqe->res != -EINTR && cqe->res != -ECONNABORTED &&
+                     cqe->res != -EAGAIN) {
+            errno = -cqe->res;
+            error("ERROR on accept");
+          }
+          break;
+        case URING_REPLIES_READY:
+          if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            uring_poll_replies(loop);
+          }
+          replies_ready = true;
+          break;
+        case URING_RECEIVE:
+          uring_complete_receive(loop, connection, cqe);
+          break;
+        case URING_SEND:
+          uring_complete_send(loop, connection, cqe);
+          break;
+        case URING_CLOSE:
+          connection->io_pending--;
+          connection_release(connection);
+          break;
+      }
+      uring_cqe_seen(&uring);
+    }
+
+    if (replies_ready) {
+      drain_replies(loop);
+      resume_stalled(loop);
+    }
+  }
+
+  // will never be reached
+  close(uring.fd);
+  return NULL;
+}
+
+/**
+ * Prints the cache counters every CACHE_REPORT_INTERVAL seconds, when they
+ * changed
+ */
+void* report_cache(void* cache_arg) {
+  struct cache_t* cache = (struct cache_t*)cache_arg;
+  uint64_t last_lookups = 0;
+  while (true) {
+    sleep(CACHE_REPORT_INTERVAL);
+    struct cache_stats_t stats = cache_get_stats(cache);
+    if (stats.hits + stats.misses == last_lookups) {
+      continue;
+    }
+    last_lookups = stats.hits + stats.misses;
+    cout << "Cache: " << stats.hits << " hits, " << stats.misses
+         << " misses, " << stats.insertions << " insertions, "
+         << stats.evictions << " evictions" << endl;
+  }
+  return NULL;
+}
+
+/**
+ * What the command line options set
+ */
+struct server_options_t {
+  int port;
+  int worker_count;
+  int shard_count;
+  bool affinity;
+  bool use_uring;
+  /**
+   * Shared by all workers. NULL for none
+   */
+  struct cache_t* cache;
+  /**
+   * Per shard. 0 for no limit
+   */
+  size_t queue_limit;
+  /**
+   * CoDel target and interval, in milliseconds. CoDel is off if the target is
+   * 0
+   */
+  int codel_target;
+  int codel_interval;
+  /**
+   * Local port of the metrics endpoint. 0 for none
+   */
+  int admin_port;
+  /**
+   * Milliseconds after which a search gives up. 0 for no limit
+   */
+  int timeout;
+  /**
+   * Threads each worker splits its searches across
+   */
+  int search_threads;
+  /**
+   * Whether to read the whole pruning table in at startup
+   */
+  bool populate_table;
+};
+
+/**
+ * What the admin port reports on
+ */
+struct admin_args {
+  int port;
+  struct metrics_registry_t* metrics;
+  struct cache_t* cache;
+  struct shard_t* shards;
+  int shard_count;
+};
+
+void admin_print_metrics(FILE* out, struct admin_args* args) {
+  struct metrics_snapshot_t* snapshot =
+      (struct metrics_snapshot_t*)malloc(sizeof(struct metrics_snapshot_t));
+  metrics_merge(args->metrics, snapshot);
+  metrics_print(out, "rubik", snapshot);
+  free(snapshot);
+
+  size_t queued = 0;
+  for (int s = 0; s < args->shard_count; s++) {
+    queued += ring_size(&args->shards[s].request_ring);
+  }
+  fprintf(out, "# HELP rubik_queued_requests Requests waiting for a worker\n");
+  fprintf(out, "# TYPE rubik_queued_requests gauge\n");
+  fprintf(out, "rubik_queued_requests %lu\n", queued);
+
+  if (args->cache != NULL) {
+    struct cache_stats_t stats = cache_get_stats(args->cache);
+    const char* names[] = {"hits", "misses", "insertions", "evictions"};
+    uint64_t values[] = {stats.hits, stats.misses, stats.insertions,
+                         stats.evictions};
+    for (int i = 0; i < 4; i++) {
+      fprintf(out, "# TYPE rubik_cache_%s_total counter\n", names[i]);
+      fprintf(out, "rubik_cache_%s_total %lu\n", names[i], values[i]);
+    }
+  }
+}
+
+/**
+ * Answers GET /metrics on 127.0.0.1:`port` in the Prometheus text format.
+ * One blocking connection at a time: scrapes are rare, and this thread
+ * never touches the event loops
+ */
+void* run_admin(void* admin_arg) {
+  struct admin_args* args = (struct admin_args*)admin_arg;
+  struct sockaddr_in address = preconnection_setup(args->port);
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int serversockfd = socket(AF_INET, SOCK_STREAM, 0);
+  int enable = 1;
+  if (serversockfd < 0 ||
+      setsockopt(serversockfd, SOL_SOCKET, SO_REUSEADDR, &enable,
+                 sizeof(enable)) < 0 ||
+      bind(serversockfd, (struct sockaddr*)&address, sizeof(address)) < 0 ||
+      listen(serversockfd, MAX_CONNECTION_QUEUE) < 0) {
+    error("ERROR opening the admin port");
+  }
+
+  char request[ADMIN_REQUEST_SIZE];
+  // a client which never sends its request must not block the next ones
+  struct timeval timeout = {1, 0};
+  while (true) {
+    int clientsockfd = accept(serversockfd, NULL, NULL);
+    if (clientsockfd < 0) {
+      continue;
+    }
+    setsockopt(clientsockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+               sizeof(timeout));
+    // the request line is all that matters
+    int length = 0;
+    int received;
+    while (length < ADMIN_REQUEST_SIZE - 1 &&
+           (received = recv(clientsockfd, request + length,
+                            ADMIN_REQUEST_SIZE - 1 - length, 0)) > 0) {
+      length += received;
+      request[length] = '\0';
+      if (strstr(request, "\r\n") != NULL) {
+        break;
+      }
+    }
+    request[length] = '\0';
+
+    char* body = NULL;
+    size_t body_length = 0;
+    FILE* out = open_memstream(&body, &body_length);
+    const char* status = "200 OK";
+    if (strncmp(request, "GET /metrics ", 13) == 0) {
+      admin_print_metrics(out, args);
+    } else {
+      status = "404 Not Found";
+      fprintf(out, "only GET /metrics is served\n");
+    }
+    fclose(out);
+
+    char header[256];
+    int header_length =
+        snprintf(header, sizeof(header),
+                 "HTTP/1.0 %s\r\n"
+                 "Content-Type: text/plain; version=0.0.4\r\n"
+                 "Content-Length: %lu\r\n"
+                 "Connection: close\r\n\r\n",
+                 status, body_length);
+    // the scraper may be gone already: nothing to do about it
+    if (write(clientsockfd, header, header_length) == header_length) {
+      size_t written = 0;
+      ssize_t result;
+      while (written < body_length &&
+             (result = write(clientsockfd, body + written,
+                             body_length - written)) > 0) {
+        written += result;
+      }
+    }
+    free(body);
+    close(clientsockfd);
+  }
+  return NULL;
+}
+
+/**
+ * Splits the workers among `shard_count` shards. With more than one shard,
+ * every shard listens on its own SO_REUSEPORT socket. With `affinity`, the
+ * threads of shard i are pinned to CPU i (modulo the CPU count). With
+ * `use_uring`, the shards do their I/O through io_uring instead of epoll.
+ * Every shard enforces the queue limit and runs CoDel on its own
+ */
+void start_server(struct server_options_t* options) {
+  int server_port = options->port;
+  int worker_count = options->worker_count;
+  int shard_count = options->shard_count;
+  struct cache_t* cache = options->cache;
+  if (shard_count > worker_count) {
+    shard_count = worker_count;
+  }
+  struct shard_t* shards =
+      (struct shard_t*)malloc(shard_count * sizeof(struct shard_t));
+  for (int s = 0; s < shard_count; s++) {
+    shards[s].loop.serversockfd =
+        open_listening_socket(server_port, shard_count > 1);
+  }
 
   // create pruning table
   cout << "Loading pruning table..." << endl;
   PruningTable table;
-  table.allocate();
-  table.load_from_file("pruning_table.bin");
+  if (!table.load_from_file("pruning_table.bin", options->populate_table)) {
+    error("ERROR loading pruning_table.bin");
+  }
+  TableBundle& bundle = GetTableBundle();
+  cout << "Mapped " << bundle.mapped_count << " of " << bundle.table_count
+       << " tables from " << TableBundleFile << endl;
   cout << "Loaded pruning table. Listening for connections on " << server_port
        << endl;
 
-  // create client queue
-  struct queue_t queue;
-  queue.lead = (queue_item_t*)malloc(sizeof(queue_item_t));
-  queue.lead_last = (queue_item_t*)malloc(sizeof(queue_item_t));
-  queue.lead->before = NULL;
-  queue.lead->next = queue.lead_last;
-  queue.lead_last->before = queue.lead;
-  queue.lead_last->next = NULL;
-  sem_init(&queue.length, 1, 0);
-  sem_init(&queue.mutex, 1, 1);
-
-  // create worker threads
-  pthread_t* workers =
-      (pthread_t*)malloc(worker_count * sizeof(pthread_t));
-  struct worker_args args;
-  args.client_queue = &queue;
-  args.pruning_table = &table;
-  for (int i = 0; i < worker_count; i++) {
-    pthread_create(&workers[i], NULL, handle_client_worker, (void*)&args);
+  if (cache != NULL) {
+    pthread_t reporter;
+    pthread_create(&reporter, NULL, report_cache, (void*)cache);
   }
 
-  while (true) {
-    clientsockfd = accept(serversockfd, NULL, 0);
+  struct metrics_registry_t metrics;
+  metrics_registry_init(&metrics);
 
-    if (clientsockfd < 0) {
-      error("ERROR on accept");
-    } else {
-      printf("Client connected\n");
+  long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  for (int s = 0; s < shard_count; s++) {
+    struct shard_t* shard = &shards[s];
+    struct event_loop_t* loop = &shard->loop;
+
+    // create request rings
+    ring_init(&shard->request_ring, REQUEST_RING_CAPACITY);
+    ring_init(&shard->reply_ring, REPLY_RING_CAPACITY);
+    loop->request_ring = &shard->request_ring;
+    loop->reply_ring = &shard->reply_ring;
+    loop->reply_eventfd = eventfd(0, EFD_NONBLOCK);
+    if (loop->reply_eventfd < 0) {
+      error("ERROR creating eventfd");
     }
+    loop->reply_signaled.store(false);
+    loop->stalled = NULL;
+    loop->cpu = options->affinity ? s % cpu_count : -1;
+    loop->request_timeout = (uint64_t)options->timeout * 1000000;
+    loop->uring = NULL;
+    loop->buffers = NULL;
+    loop->metrics = metrics_register(&metrics);
+
+    shard->args.request_ring = &shard->request_ring;
+    shard->args.reply_ring = &shard->reply_ring;
+    shard->args.reply_eventfd = loop->reply_eventfd;
+    shard->args.reply_signaled = &loop->reply_signaled;
+    shard->args.pruning_table = &table;
+    shard->args.cache = cache;
+    shard->args.metrics = &metrics;
+    shard->args.search_threads = options->search_threads;
+
+    // create worker threads: the first shards take the remainder
+    shard->worker_count =
+        worker_count / shard_count + (s < worker_count % shard_count);
 
-    // enqueue client (a worker will pick it up)
-    sem_wait(&queue.mutex);
-    struct queue_item_t* newclient =
-        (struct queue_item_t*)malloc(sizeof(struct queue_item_t));
-    struct queue_item_t* current_first = queue.lead->next;
-    newclient->before = queue.lead;
-    newclient->next = current_first;
-    queue.lead->next = newclient;
-    current_first->before = newclient;
-    newclient->clientsockfd = clientsockfd;
-    sem_post(&queue.mutex);
-    sem_post(&queue.length);
+    struct admission_t* admission = &shard->admission;
+    admission->queue_limit = options->queue_limit;
+    admission->use_codel = options->codel_target > 0;
+    codel_init(&admission->codel, (uint64_t)options->codel_target * 1000000,
+               (uint64_t)options->codel_interval * 1000000);
+    admission->worker_count = shard->worker_count;
+    admission->service_time.store(0);
+    loop->admission = admission;
+    shard->args.admission = admission;
+    shard->workers =
+        (pthread_t*)malloc(shard->worker_count * sizeof(pthread_t));
+    for (int i = 0; i < shard->worker_count; i++) {
+      pthread_create(&shard->workers[i], NULL, run_worker, (void*)shard);
+    }
+    pthread_create(&shard->event_loop_thread, NULL,
+                   options->use_uring ? run_uring_event_loop : run_event_loop,
+                   (void*)shard);
+  }
+
+  struct admin_args admin;
+  if (options->admin_port > 0) {
+    admin.port = options->admin_port;
+    admin.metrics = &metrics;
+    admin.cache = cache;
+    admin.shards = shards;
+    admin.shard_count = shard_count;
+    pthread_t admin_thread;
+    pthread_create(&admin_thread, NULL, run_admin, (void*)&admin);
   }
 
-  // finalization code. Will never be reached
-  close(serversockfd);
-  for (int i = 0; i < worker_count; i++) {
-    pthread_join(workers[i], NULL);
+  // finalization code. Will never be reached: event loops never return
+  for (int s = 0; s < shard_count; s++) {
+    pthread_join(shards[s].event_loop_thread, NULL);
+    for (int i = 0; i < shards[s].worker_count; i++) {
+      pthread_join(shards[s].workers[i], NULL);
+    }
+    close(shards[s].loop.reply_eventfd);
+    close(shards[s].loop.serversockfd);
   }
 }
 
 int main(int argc, char* argv[]) {
-  int server_port;
-  int worker_count;
+  struct server_options_t options;
+  options.shard_count = 1;
+  options.affinity = false;
+  options.use_uring = false;
+  options.cache = NULL;
+  options.queue_limit = 0;
+  options.codel_target = 0;
+  options.codel_interval = DEFAULT_CODEL_INTERVAL;
+  options.timeout = 0;
+  options.admin_port = 0;
+  options.search_threads = 1;
+  options.populate_table = false;
+  int cache_megabytes = 0;
+  bool cache_inverse = false;
 
   if (argc < 3) {
-    fprintf(stderr, "usage %s server_port worker_count\n", argv[0]);
+    fprintf(stderr,
+            "usage %s server_port worker_count [--shards=N] [--affinity] "
+            "[--io=epoll|uring] [--cache=MEGABYTES] [--cache-inverse] "
+            "[--queue-limit=N] [--codel-target=MS] [--codel-interval=MS] "
+            "[--timeout=MS] [--admin-port=PORT] [--parallel=N] "
+            "[--populate]\n",
+            argv[0]);
     exit(0);
   }
-  server_port = atoi(argv[1]);
-  worker_count = atoi(argv[2]);
+  options.port = atoi(argv[1]);
+  options.worker_count = atoi(argv[2]);
+  for (int i = 3; i < argc; i++) {
+    if (strncmp(argv[i], "--shards=", 9) == 0) {
+      options.shard_count = atoi(argv[i] + 9);
+    } else if (strcmp(argv[i], "--affinity") == 0) {
+      options.affinity = true;
+    } else if (strcmp(argv[i], "--io=epoll") == 0) {
+      options.use_uring = false;
+    } else if (strcmp(argv[i], "--io=uring") == 0) {
+      options.use_uring = true;
+    } else if (strncmp(argv[i], "--cache=", 8) == 0) {
+      cache_megabytes = atoi(argv[i] + 8);
+    } else if (strcmp(argv[i], "--cache-inverse") == 0) {
+      cache_inverse = true;
+    } else if (strncmp(argv[i], "--queue-limit=", 14) == 0) {
+      options.queue_limit = atoi(argv[i] + 14);
+    } else if (strncmp(argv[i], "--codel-target=", 15) == 0) {
+      options.codel_target = atoi(argv[i] + 15);
+    } else if (strncmp(argv[i], "--codel-interval=", 17) == 0) {
+      options.codel_interval = atoi(argv[i] + 17);
+    } else if (strncmp(argv[i], "--timeout=", 10) == 0) {
+      options.timeout = atoi(argv[i] + 10);
+    } else if (strncmp(argv[i], "--admin-port=", 13) == 0) {
+      options.admin_port = atoi(argv[i] + 13);
+    } else if (strncmp(argv[i], "--parallel=", 11) == 0) {
+      options.search_threads = atoi(argv[i] + 11);
+    } else if (strcmp(argv[i], "--populate") == 0) {
+      options.populate_table = true;
+    } else {
+      fprintf(stderr, "unknown option %s\n", argv[i]);
+      exit(1);
+    }
+  }
+  if (options.worker_count < 1 || options.shard_count < 1 ||
+      options.search_threads < 1) {
+    fprintf(stderr,
+            "worker_count, shards and parallel must be at least 1\n");
+    exit(1);
+  }
+  if (options.codel_target < 0 || options.codel_interval < 1) {
+    fprintf(stderr, "the CoDel interval must be at least 1 ms\n");
+    exit(1);
+  }
 
-  start_server(server_port, worker_count);
-}
\ No newline at end of file
+  if (cache_megabytes > 0) {
+    options.cache = (struct cache_t*)malloc(sizeof(struct cache_t));
+    if (!cache_init(options.cache, (size_t)cache_megabytes << 20,
+                    cache_inverse)) {
+      fprintf(stderr, "could not allocate a %d MB cache\n", cache_megabytes);
+      exit(1);
+    }
+  }
+
+  start_server(&options);
+}
@@ -0,0 +1,283 @@
+/**
+ * The few pieces of io_uring the server needs, on top of the raw system
+ * calls (liburing is not required).
+ *
+ * Submissions are only queued by uring_get_sqe: nothing reaches the kernel
+ * until uring_submit_and_wait, so every operation prepared while handling a
+ * batch of completions costs a single io_uring_enter call. Submissions which
+ * find the ring full wait in a backlog, and enter it in order as the kernel
+ * consumes entries: none is ever dropped.
+ */
+
+#ifndef __URING__
+#define __URING__
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct uring_t {
+  int fd;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  struct io_uring_sqe* sqes;
+  /**
+   * Submissions prepared but not yet handed to the kernel lie between
+   * `*sq_tail` and `sq_local_tail`
+   */
+  unsigned sq_local_tail;
+  /**
+   * Submissions prepared while the ring was full, oldest first
+   */
+  struct io_uring_sqe* backlog;
+  unsigned backlog_count;
+  unsigned backlog_capacity;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe* cqes;
+};
+
+inline unsigned uring_load_acquire(unsigned* p) {
+  return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+inline void uring_store_release(unsigned* p, unsigned value) {
+  __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/**
+ * Returns false if io_uring is not available (old kernel, or disabled)
+ */
+bool uring_init(struct uring_t* uring, unsigned entries) {
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  // only the event loop thread submits, and it only needs completions when
+  // it asks for them
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+  uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  if (uring->fd < 0 && errno == EINVAL) {
+    // kernels older than 6.0 know neither flag
+    memset(&params, 0, sizeof(params));
+    uring->fd = syscall(__NR_io_uring_setup, entries, &params);
+  }
+  if (uring->fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP) ||
+      !(params.features & IORING_FEAT_NODROP)) {
+    return false;
+  }
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  size_t rings_size = sq_size > cq_size ? sq_size : cq_size;
+  char* rings = (char*)mmap(NULL, rings_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, uring->fd,
+                            IORING_OFF_SQ_RING);
+  if (rings == MAP_FAILED) {
+    return false;
+  }
+  uring->sqes = (struct io_uring_sqe*)mmap(
+      NULL, params.sq_entries * sizeof(struct io_uring_sqe),
+      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd,
+      IORING_OFF_SQES);
+  if (uring->sqes == MAP_FAILED) {
+    return false;
+  }
+
+  uring->sq_head = (unsigned*)(rings + params.sq_off.head);
+  uring->sq_tail = (unsigned*)(rings + params.sq_off.tail);
+  uring->sq_mask = *(unsigned*)(rings + params.sq_off.ring_mask);
+  uring->sq_entries = params.sq_entries;
+  uring->sq_local_tail = *uring->sq_tail;
+  // submission slot i always holds sqe i
+  unsigned* sq_array = (unsigned*)(rings + params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; i++) {
+    sq_array[i] = i;
+  }
+  uring->cq_head = (unsigned*)(rings + params.cq_off.head);
+  uring->cq_tail = (unsigned*)(rings + params.cq_off.tail);
+  uring->cq_mask = *(unsigned*)(rings + params.cq_off.ring_mask);
+  uring->cqes = (struct io_uring_cqe*)(rings + params.cq_off.cqes);
+  uring->backlog = NULL;
+  uring->backlog_count = 0;
+  uring->backlog_capacity = 0;
+  return true;
+}
+
+inline bool uring_sq_full(struct uring_t* uring) {
+  return uring->sq_local_tail - uring_load_acquire(uring->sq_head) ==
+         uring->sq_entries;
+}
+
+/**
+ * Moves as much of the backlog into the ring as the kernel made room for
+ */
+void uring_flush_backlog(struct uring_t* uring) {
+  unsigned moved = 0;
+  while (moved < uring->backlog_count && !uring_sq_full(uring)) {
+    uring->sqes[uring->sq_local_tail & uring->sq_mask] = uring->backlog[moved];
+    uring->sq_local_tail++;
+    moved++;
+  }
+  memmove(uring->backlog, uring->backlog + moved,
+          (uring->backlog_count - moved) * sizeof(struct io_uring_sqe));
+  uring->backlog_count -= moved;
+}
+
+/**
+ * Hands every prepared submission to the kernel and waits until at least
+ * `wait_count` completions are available. The kernel may take fewer than
+ * that, or none if completions must be reaped first (EAGAIN, EBUSY): the
+ * rest goes with the next call
+ */
+void uring_submit_and_wait(struct uring_t* uring, unsigned wait_count) {
+  uring_flush_backlog(uring);
+  uring_store_release(uring->sq_tail, uring->sq_local_tail);
+  unsigned to_submit =
+      uring->sq_local_tail - uring_load_acquire(uring->sq_head);
+  while (true) {
+    int submitted =
+        syscall(__NR_io_uring_enter, uring->fd, to_submit, wait_count,
+                wait_count > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (submitted >= 0 || errno == EAGAIN || errno == EBUSY) {
+      // on EAGAIN and EBUSY the caller must reap completions first. What was
+      // not submitted yet goes with the next call
+      return;
+    }
+    if (errno != EINTR) {
+      perror("ERROR on io_uring_enter");
+      exit(1);
+    }
+    to_submit = uring->sq_local_tail - uring_load_acquire(uring->sq_head);
+  }
+}
+
+/**
+ * A zeroed submission, queued until the next uring_submit_and_wait. Valid
+ * until the next call
+ */
+struct io_uring_sqe* uring_get_sqe(struct uring_t* uring) {
+  if (uring->backlog_count > 0) {
+    uring_flush_backlog(uring);
+  }
+  if (uring->backlog_count == 0 && uring_sq_full(uring)) {
+    // make room without waiting for completions, if the kernel lets us
+    uring_submit_and_wait(uring, 0);
+  }
+  struct io_uring_sqe* sqe;
+  if (uring->backlog_count == 0 && !uring_sq_full(uring)) {
+    sqe = &uring->sqes[uring->sq_local_tail & uring->sq_mask];
+    uring->sq_local_tail++;
+  } else {
+    // still full: the ring's oldest entries are not consumed yet, and later
+    // submissions must not overtake the backlog
+    if (uring->backlog_count == uring->backlog_capacity) {
+      uring->backlog_capacity =
+          uring->backlog_capacity == 0 ? 64 : 2 * uring->backlog_capacity;
+      uring->backlog = (struct io_uring_sqe*)realloc(
+          uring->backlog,
+          uring->backlog_capacity * sizeof(struct io_uring_sqe));
+      if (uring->backlog == NULL) {
+        perror("ERROR growing the io_uring backlog");
+        exit(1);
+      }
+    }
+    sqe = &uring->backlog[uring->backlog_count++];
+  }
+  memset(sqe, 0, sizeof(*sqe));
+  return sqe;
+}
+
+// returns NULL if no completion is available
+inline struct io_uring_cqe* uring_peek_cqe(struct uring_t* uring) {
+  unsigned head = *uring->cq_head;
+  if (head == uring_load_acquire(uring->cq_tail)) {
+    return NULL;
+  }
+  return &uring->cqes[head & uring->cq_mask];
+}
+
+// the completion returned by uring_peek_cqe may be overwritten after this
+inline void uring_cqe_seen(struct uring_t* uring) {
+  uring_store_release(uring->cq_head, *uring->cq_head + 1);
+}
+
+/**
+ * A provided buffer ring: `count` buffers of `size` bytes that the kernel
+ * picks from when a receive completes, so that idle connections do not hold
+ * a buffer of their own
+ */
+struct uring_buffers_t {
+  struct io_uring_buf_ring* ring;
+  char* memory;
+  unsigned count;
+  unsigned size;
+  unsigned short group;
+  unsigned short tail;
+};
+
+inline char* uring_buffer(struct uring_buffers_t* buffers, unsigned id) {
+  return buffers->memory + (size_t)id * buffers->size;
+}
+
+/**
+ * Gives buffer `id` back to the kernel
+ */
+void uring_buffer_recycle(struct uring_buffers_t* buffers, unsigned id) {
+  // not `ring->bufs`: C++ compilers put that flexible array member after a
+  // padding byte
+  struct io_uring_buf* buffer = (struct io_uring_buf*)buffers->ring +
+                                (buffers->tail & (buffers->count - 1));
+  buffer->addr = (uint64_t)uring_buffer(buffers, id);
+  buffer->len = buffers->size;
+  buffer->bid = id;
+  buffers->tail++;
+  __atomic_store_n(&buffers->ring->tail, buffers->tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * `count` must be a power of two. Returns false if the kernel does not
+ * support provided buffer rings (older than 5.19)
+ */
+bool uring_buffers_init(struct uring_t* uring,
+                        struct uring_buffers_t* buffers,
+                        unsigned short group,
+                        unsigned count,
+                        unsigned size) {
+  size_t ring_size = count * sizeof(struct io_uring_buf);
+  buffers->ring = (struct io_uring_buf_ring*)mmap(
+      NULL, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+      0);
+  buffers->memory = (char*)malloc((size_t)count * size);
+  if (buffers->ring == MAP_FAILED || buffers->memory == NULL) {
+    return false;
+  }
+  buffers->count = count;
+  buffers->size = size;
+  buffers->group = group;
+  buffers->tail = 0;
+
+  struct io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = (uint64_t)buffers->ring;
+  registration.ring_entries = count;
+  registration.bgid = group;
+  if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING,
+              &registration, 1) < 0) {
+    return false;
+  }
+  for (unsigned id = 0; id < count; id++) {
+    uring_buffer_recycle(buffers, id);
+  }
+  return true;
+}
+
+#endif